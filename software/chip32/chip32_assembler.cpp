@@ -24,6 +24,7 @@ THE SOFTWARE.
 
 
 #include "chip32_assembler.h"
+#include "fnv1a.h"
 
 #include <sstream>
 #include <vector>
@@ -32,6 +33,9 @@ THE SOFTWARE.
 #include <cstdint>
 #include <iterator>
 #include <string>
+#include <fstream>
+#include <iomanip>
+#include <set>
 
 namespace Chip32
 {
@@ -55,7 +59,8 @@ static const uint32_t NbRegs = sizeof(AllRegs) / sizeof(AllRegs[0]);
 // Keep same order than the opcodes list!!
 static const std::string Mnemonics[] = {
     "nop", "halt", "syscall", "lcons", "mov", "push", "pop", "store", "load", "add", "sub", "mul", "div",
-    "shiftl", "shiftr", "ishiftr", "and", "or", "xor", "not", "call", "ret", "jump", "jumpr", "skipz", "skipnz"
+    "shiftl", "shiftr", "ishiftr", "and", "or", "xor", "not", "call", "ret", "jump", "jumpr", "skipz", "skipnz",
+    "lcons8", "lcons16", "jumps"
 };
 
 static OpCode OpCodes[] = OPCODES_LIST;
@@ -93,16 +98,21 @@ static inline void leu16_put(std::vector<std::uint8_t> &container, uint16_t data
     container.push_back((data >> 8U) & 0xFFU);
 }
 
-#define GET_REG(name, ra) if (!GetRegister(name, ra)) {\
-    m_lastError.line -1; \
-    m_lastError.message = "ERROR! Bad register name: " + name; \
-    return false; }
-
 #define CHIP32_CHECK(instr, cond, error) if (!(cond)) { \
     m_lastError.line = instr.line; \
     m_lastError.message = error; \
     return false; } \
 
+static void ReplaceAll(std::string &text, const std::string &toFind, const std::string &toReplace)
+{
+    size_t pos = 0;
+    while ((pos = text.find(toFind, pos)) != std::string::npos)
+    {
+        text.replace(pos, toFind.size(), toReplace);
+        pos += toReplace.size();
+    }
+}
+
 std::vector<std::string> Split(std::string line)
 {
     std::vector<std::string> result;
@@ -164,9 +174,50 @@ bool Assembler::GetRegisterName(uint8_t reg, std::string &regName)
     return false;
 }
 
-bool Assembler::CompileMnemonicArguments(Instr &instr)
+bool Assembler::ParseArguments(Instr &instr, std::vector<Operand> &operands)
 {
-    uint8_t ra, rb;
+    // Text arguments are converted to operands, the encoding is shared with the direct code generation
+    for (size_t i = 0; i < instr.args.size(); i++)
+    {
+        std::string a = instr.args[i];
+        uint8_t reg;
+
+        // Memory address register: store @r4, r1, 2 / load r1, @r4, 2
+        if (((instr.code.opcode == OP_STORE) && (i == 0)) || ((instr.code.opcode == OP_LOAD) && (i == 1)))
+        {
+            CHIP32_CHECK(instr, a.at(0) == '@', "Missing @ sign before register")
+            a.erase(0, 1);
+        }
+
+        if ((a.at(0) == '$') || (a.at(0) == '.')) {
+            operands.push_back(Operand::Lbl(a));
+        } else if (GetRegister(a, reg)) {
+            operands.push_back(Operand::Reg(static_cast<chip32_register_t>(reg)));
+        } else {
+            operands.push_back(Operand::Imm(static_cast<uint32_t>(strtol(a.c_str(),  NULL, 0))));
+        }
+    }
+    return true;
+}
+
+bool Assembler::Encode(Instr &instr, const std::vector<Operand> &args)
+{
+    CHIP32_CHECK(instr, args.size() == instr.code.nbAargs,
+                 "Bad number of parameters. Required: " + std::to_string(static_cast<int>(instr.code.nbAargs)) + ", got: " + std::to_string(args.size()));
+
+    auto reg = [this, &instr, &args](size_t i) {
+        if (args[i].type != Operand::Register)
+        {
+            m_lastError.line = instr.line;
+            m_lastError.message = "ERROR! Bad register name: " + (i < instr.args.size() ? instr.args[i] : std::to_string(args[i].value));
+            return false;
+        }
+        instr.compiledArgs.push_back(args[i].value);
+        return true;
+    };
+
+    instr.compiledArgs.clear();
+    instr.useLabel = false;
 
     switch(instr.code.opcode)
     {
@@ -176,17 +227,35 @@ bool Assembler::CompileMnemonicArguments(Instr &instr)
         // no arguments, just use the opcode
         break;
     case OP_SYSCALL:
-        instr.compiledArgs.push_back(static_cast<uint8_t>(strtol(instr.args[0].c_str(),  NULL, 0)));
+        CHIP32_CHECK(instr, args[0].type == Operand::Immediate, "syscall number must be an integer");
+        instr.compiledArgs.push_back(static_cast<uint8_t>(args[0].value));
         break;
     case OP_LCONS:
-        GET_REG(instr.args[0], ra);
-        instr.compiledArgs.push_back(ra);
+    case OP_LCONS8:
+    case OP_LCONS16:
+        if (!reg(0)) {
+            return false;
+        }
         // Detect address or immedate value
-        if ((instr.args[1].at(0) == '$') || (instr.args[1].at(0) == '.')) {
+        if (args[1].type == Operand::Label) {
+            // ROM addresses fit in 16 bits, RAM labels are promoted to 32 bits during the relaxation pass
             instr.useLabel = true;
-            leu32_put(instr.compiledArgs, 0); // reserve 4 bytes
-        } else { // immediate value
-            leu32_put(instr.compiledArgs, static_cast<uint32_t>(strtol(instr.args[1].c_str(),  NULL, 0)));
+            instr.label = args[1].text;
+            instr.code = OpCodes[OP_LCONS16];
+            leu16_put(instr.compiledArgs, 0); // reserve 2 bytes
+        } else { // immediate value, use the smallest encoding
+            CHIP32_CHECK(instr, args[1].type == Operand::Immediate, "lcons needs a value or a label");
+            uint32_t value = args[1].value;
+            if (value <= UINT8_MAX) {
+                instr.code = OpCodes[OP_LCONS8];
+                instr.compiledArgs.push_back(value);
+            } else if (value <= UINT16_MAX) {
+                instr.code = OpCodes[OP_LCONS16];
+                leu16_put(instr.compiledArgs, value);
+            } else {
+                instr.code = OpCodes[OP_LCONS];
+                leu32_put(instr.compiledArgs, value);
+            }
         }
         break;
     case OP_POP:
@@ -195,8 +264,10 @@ bool Assembler::CompileMnemonicArguments(Instr &instr)
     case OP_SKIPNZ:
     case OP_CALL:
     case OP_JUMPR:
-        GET_REG(instr.args[0], ra);
-        instr.compiledArgs.push_back(ra);
+    case OP_NOT:
+        if (!reg(0)) {
+            return false;
+        }
         break;
     case OP_MOV:
     case OP_ADD:
@@ -209,35 +280,26 @@ bool Assembler::CompileMnemonicArguments(Instr &instr)
     case OP_AND:
     case OP_OR:
     case OP_XOR:
-    case OP_NOT:
-        GET_REG(instr.args[0], ra);
-        GET_REG(instr.args[1], rb);
-        instr.compiledArgs.push_back(ra);
-        instr.compiledArgs.push_back(rb);
+        if (!reg(0) || !reg(1)) {
+            return false;
+        }
         break;
     case OP_JUMP:
-        // Reserve 2 bytes for address, it will be filled at the end
+    case OP_JUMPS:
+        // Start with a short relative jump, promoted to an absolute one during relaxation if the target is too far
+        CHIP32_CHECK(instr, args[0].type == Operand::Label, "jump destination must be a label");
         instr.useLabel = true;
-        instr.compiledArgs.push_back(0);
+        instr.label = args[0].text;
+        instr.code = OpCodes[OP_JUMPS];
         instr.compiledArgs.push_back(0);
         break;
     case OP_STORE: // store @r4, r1, 2
-        CHIP32_CHECK(instr, instr.args[0].at(0) == '@', "Missing @ sign before register")
-        instr.args[0].erase(0, 1);
-        GET_REG(instr.args[0], ra);
-        GET_REG(instr.args[1], rb);
-        instr.compiledArgs.push_back(ra);
-        instr.compiledArgs.push_back(rb);
-        instr.compiledArgs.push_back(static_cast<uint32_t>(strtol(instr.args[2].c_str(),  NULL, 0)));
-        break;
-    case OP_LOAD:
-        CHIP32_CHECK(instr, instr.args[1].at(0) == '@', "Missing @ sign before register")
-        instr.args[1].erase(0, 1);
-        GET_REG(instr.args[0], ra);
-        GET_REG(instr.args[1], rb);
-        instr.compiledArgs.push_back(ra);
-        instr.compiledArgs.push_back(rb);
-        instr.compiledArgs.push_back(static_cast<uint32_t>(strtol(instr.args[2].c_str(),  NULL, 0)));
+    case OP_LOAD:  // load r1, @r4, 2
+        if (!reg(0) || !reg(1)) {
+            return false;
+        }
+        CHIP32_CHECK(instr, args[2].type == Operand::Immediate, "memory access size must be an integer");
+        instr.compiledArgs.push_back(static_cast<uint8_t>(args[2].value));
         break;
     default:
         CHIP32_CHECK(instr, false, "Unsupported mnemonic: " + instr.mnemonic);
@@ -246,37 +308,34 @@ bool Assembler::CompileMnemonicArguments(Instr &instr)
     return true;
 }
 
-bool Assembler::CompileConstantArgument(Instr &instr, const std::string &a)
+bool Assembler::CompileConstantArgument(Instr &instr, const Operand &value)
 {
-    instr.compiledArgs.clear(); instr.args.clear(); instr.useLabel = false;
+    instr.compiledArgs.clear(); instr.args.clear(); instr.label.clear();
+    instr.useLabel = false; instr.isString = false;
 
-    // Check string
-    if (a.size() > 2)
+    if (value.type == Operand::String)
     {
-        // Detected string
-        if ((a[0] == '"') && (a[a.size() - 1] == '"'))
+        for (char c : value.text)
         {
-            for (unsigned int i = 1; i < (a.size() - 1); i++)
-            {
-                instr.compiledArgs.push_back(a[i]);
-            }
-            instr.compiledArgs.push_back(0);
-            return true;
-        }
-        // Detect label
-        else if (a[0] == '.')
-        {
-            // Label must be 32-bit, throw an error if not the case
-            CHIP32_CHECK(instr, instr.dataTypeSize == 32, "Labels must be stored in a 32-bit area (DC32)")
-            instr.useLabel = true;
-            instr.args.push_back(a);
-            leu32_put(instr.compiledArgs, 0); // reserve 4 bytes
-            return true;
+            instr.compiledArgs.push_back(c);
         }
+        instr.compiledArgs.push_back(0);
+        instr.isString = true;
+        return true;
+    }
+    else if (value.type == Operand::Label)
+    {
+        // Label must be 32-bit, throw an error if not the case
+        CHIP32_CHECK(instr, instr.dataTypeSize == 32, "Labels must be stored in a 32-bit area (DC32)")
+        instr.useLabel = true;
+        instr.label = value.text;
+        leu32_put(instr.compiledArgs, 0); // reserve 4 bytes
+        return true;
     }
 
     // here, we check if the intergers are correct
-    uint32_t intVal = static_cast<uint32_t>(strtol(a.c_str(),  NULL, 0));
+    CHIP32_CHECK(instr, value.type == Operand::Immediate, "constants cannot use registers");
+    uint32_t intVal = value.value;
 
     bool sizeOk = false;
     if (((intVal <= UINT8_MAX) && (instr.dataTypeSize == 8)) ||
@@ -295,10 +354,12 @@ bool Assembler::CompileConstantArgument(Instr &instr, const std::string &a)
     return true;
 }
 
+
 bool Assembler::BuildBinary(std::vector<uint8_t> &program, Result &result)
 {
     program.clear();
-    result = { 0, 0, 0}; // clear stuff!
+    result = Result(); // clear stuff!
+    result.pooledSize = m_pooledBytes;
 
     // serialize each instruction and arguments to program memory, assign address to variables (rom or ram)
     for (auto &i : m_instructions)
@@ -321,20 +382,322 @@ bool Assembler::BuildBinary(std::vector<uint8_t> &program, Result &result)
     return true;
 }
 
-bool Assembler::Parse(const std::string &data)
+// Nodes generated by the story editor start with this label, eg: .mediaEntry0004
+static std::string NodePrefix(const std::string &label)
+{
+    static const std::string prefix = ".mediaEntry";
+    if (label.compare(0, prefix.size(), prefix) != 0)
+    {
+        return "";
+    }
+    size_t end = label.find_first_not_of("0123456789", prefix.size());
+    return label.substr(0, end);
+}
+
+static std::string JsonString(const std::string &text)
+{
+    std::string s = "\"";
+    for (char c : text)
+    {
+        if ((c == '"') || (c == '\\')) {
+            s += '\\';
+        }
+        s += c;
+    }
+    return s + "\"";
+}
+
+void Assembler::GenerateMap(std::ostream &out)
+{
+    struct Entry {
+        std::string name;
+        std::string section;
+        uint32_t addr{0};
+        uint32_t size{0};
+        std::string alias;
+    };
+
+    struct Node {
+        std::string name;
+        uint32_t addr{0};
+        uint32_t code{0};
+        std::set<std::string> constants; //!< ROM constants used by the node code
+    };
+
+    std::vector<Entry> rom;
+    std::vector<Entry> ram;
+    std::vector<Node> nodes;
+    std::map<std::string, uint32_t> dataSizes;
+    uint32_t codeSize = 0;
+    uint32_t dataSize = 0;
+    uint32_t ramSize = 0;
+    int codeEntry = -1; // code without label (start of the program) is only counted in the totals
+    int node = -1;
+
+    for (const auto &i : m_instructions)
+    {
+        if (i.isRamData)
+        {
+            uint32_t size = i.dataLen * i.dataTypeSize/8;
+            ram.push_back({i.mnemonic, "ram", i.addr, size, ""});
+            ramSize += size;
+        }
+        else if (i.isLabel)
+        {
+            codeEntry = rom.size();
+            rom.push_back({i.mnemonic, "code", i.addr, 0, ""});
+
+            // Internal labels of a node (eg: .mediaEntry0004_loop) are part of the node
+            std::string prefix = NodePrefix(i.mnemonic);
+            if (prefix.empty())
+            {
+                node = -1;
+            }
+            else if ((node < 0) || (nodes[node].name != prefix))
+            {
+                node = nodes.size();
+                nodes.push_back({prefix, i.addr, 0, {}});
+            }
+        }
+        else if (i.isRomData)
+        {
+            if (rom.empty() || (rom.back().name != i.mnemonic))
+            {
+                rom.push_back({i.mnemonic, "data", i.addr, 0, ""});
+            }
+            rom.back().size += i.compiledArgs.size();
+            dataSizes[i.mnemonic] += i.compiledArgs.size();
+            dataSize += i.compiledArgs.size();
+        }
+        else
+        {
+            uint32_t size = 1 + i.compiledArgs.size();
+            codeSize += size;
+            if (codeEntry >= 0)
+            {
+                rom[codeEntry].size += size;
+            }
+            if (node >= 0)
+            {
+                nodes[node].code += size;
+                const std::string &l = i.label;
+                if (i.useLabel && (l[0] == '$') && (m_labels.count(l) > 0) && !m_labels[l].isRamData)
+                {
+                    nodes[node].constants.insert(m_aliases.count(l) > 0 ? m_aliases[l] : l);
+                }
+            }
+        }
+    }
+
+    // Pooled constants share the address and size of the stored one
+    std::vector<Entry> labels;
+    for (const auto &e : rom)
+    {
+        labels.push_back(e);
+        for (const auto &alias : m_aliases)
+        {
+            if ((e.section == "data") && (alias.second == e.name))
+            {
+                labels.push_back({alias.first, e.section, e.addr, e.size, e.name});
+            }
+        }
+    }
+    labels.insert(labels.end(), ram.begin(), ram.end());
+
+    out << "{\n"
+        << "    \"rom\": { \"size\": " << codeSize + dataSize << ", \"code\": " << codeSize << ", \"data\": " << dataSize
+        << ", \"pooled\": " << m_pooledBytes << " },\n"
+        << "    \"ram\": { \"size\": " << ramSize << " },\n"
+        << "    \"labels\": [";
+
+    for (size_t i = 0; i < labels.size(); i++)
+    {
+        const Entry &e = labels[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "        { \"name\": " << JsonString(e.name) << ", \"section\": \"" << e.section << "\", \"address\": " << e.addr
+            << ", \"size\": " << e.size;
+        if (!e.alias.empty())
+        {
+            out << ", \"alias\": " << JsonString(e.alias);
+        }
+        out << " }";
+    }
+    out << "\n    ],\n    \"nodes\": [";
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const Node &n = nodes[i];
+        uint32_t data = 0;
+        std::string constants;
+        for (const auto &c : n.constants)
+        {
+            data += dataSizes[c];
+            constants += (constants.empty() ? "" : ", ") + JsonString(c);
+        }
+        out << (i == 0 ? "\n" : ",\n")
+            << "        { \"name\": " << JsonString(n.name) << ", \"address\": " << n.addr << ", \"code\": " << n.code
+            << ", \"data\": " << data << ", \"total\": " << n.code + data << ", \"constants\": [" << constants << "] }";
+    }
+    out << "\n    ]\n}\n";
+}
+
+void Assembler::GenerateListing(std::ostream &out)
+{
+    static const size_t cBytesPerLine = 8;
+
+    out << "ADDR    BYTES                     LINE  SOURCE\n";
+    for (const auto &i : m_instructions)
+    {
+        std::vector<uint8_t> bytes;
+        std::string text;
+
+        if (i.isRamData)
+        {
+            text = i.mnemonic + " DV" + std::to_string(i.dataTypeSize) + " " + std::to_string(i.dataLen);
+        }
+        else if (i.isLabel)
+        {
+            text = i.mnemonic + ":";
+        }
+        else if (i.isRomData)
+        {
+            bytes = i.compiledArgs;
+            text = i.mnemonic + " DC" + std::to_string(i.dataTypeSize) + " " + ArgumentsText(i);
+        }
+        else
+        {
+            bytes.push_back(i.code.opcode);
+            bytes.insert(bytes.end(), i.compiledArgs.begin(), i.compiledArgs.end());
+            text = "    " + i.mnemonic + " " + ArgumentsText(i);
+        }
+
+        // RAM addresses are prefixed with R, ROM ones with a space
+        size_t offset = 0;
+        do
+        {
+            std::stringstream hex;
+            for (size_t b = offset; (b < bytes.size()) && (b < offset + cBytesPerLine); b++)
+            {
+                hex << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << static_cast<int>(bytes[b]) << " ";
+            }
+
+            out << (i.isRamData ? 'R' : ' ')
+                << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << i.addr + offset << std::dec << "   "
+                << std::left << std::setw(cBytesPerLine * 3 + 2) << std::setfill(' ') << hex.str() << std::right;
+            if (offset == 0)
+            {
+                out << std::setw(4) << i.line << "  " << text;
+            }
+            out << "\n";
+            offset += cBytesPerLine;
+        } while (offset < bytes.size());
+    }
+}
+
+std::string Assembler::ArgumentsText(const Instr &instr)
+{
+    const std::vector<uint8_t> &a = instr.compiledArgs;
+    std::string label = m_aliases.count(instr.label) > 0 ? m_aliases[instr.label] : instr.label;
+    auto reg = [this, &a](size_t i) {
+        std::string name;
+        GetRegisterName(a[i], name);
+        return name;
+    };
+    // Little endian value of the bytes [first, end[
+    auto value = [&a](size_t first) {
+        uint32_t v = 0;
+        for (size_t i = a.size(); i > first; i--)
+        {
+            v = (v << 8U) | a[i - 1];
+        }
+        return std::to_string(v);
+    };
+
+    if (instr.isRomData)
+    {
+        if (instr.isString) {
+            return "\"" + std::string(a.begin(), a.end() - 1) + "\"";
+        }
+        return instr.useLabel ? label : value(0);
+    }
+
+    switch (instr.code.opcode)
+    {
+    case OP_NOP:
+    case OP_HALT:
+    case OP_RET:
+        return "";
+    case OP_SYSCALL:
+        return value(0);
+    case OP_LCONS:
+    case OP_LCONS8:
+    case OP_LCONS16:
+        return reg(0) + ", " + (instr.useLabel ? label : value(1));
+    case OP_JUMP:
+    case OP_JUMPS:
+        return label;
+    case OP_STORE:
+        return "@" + reg(0) + ", " + reg(1) + ", " + value(2);
+    case OP_LOAD:
+        return reg(0) + ", @" + reg(1) + ", " + value(2);
+    default:
+        break;
+    }
+
+    // Register operands
+    std::string text;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        text += (i == 0 ? "" : ", ") + reg(i);
+    }
+    return text;
+}
+
+void Assembler::GenerateSource(std::ostream &out)
+{
+    int line = 0;
+
+    for (size_t n = 0; n < m_instructions.size(); n++)
+    {
+        Instr &i = m_instructions[n];
+        i.line = ++line;
+
+        if (i.isLabel)
+        {
+            out << i.mnemonic << ":\n";
+        }
+        else if (i.isRamData)
+        {
+            out << i.mnemonic << " DV" << i.dataTypeSize << " " << i.dataLen << "\n";
+        }
+        else if (i.isRomData)
+        {
+            // One instruction per value, all on the same line
+            out << i.mnemonic << " DC" << i.dataTypeSize << " " << ArgumentsText(i);
+            while ((n + 1 < m_instructions.size()) && m_instructions[n + 1].isRomData && (m_instructions[n + 1].mnemonic == i.mnemonic))
+            {
+                n++;
+                m_instructions[n].line = line;
+                out << ", " << ArgumentsText(m_instructions[n]);
+            }
+            out << "\n";
+        }
+        else
+        {
+            out << "    " << i.mnemonic << " " << ArgumentsText(i) << "\n";
+        }
+    }
+}
+
+bool Assembler::Tokenize(const std::string &data, std::vector<Line> &lines)
 {
     std::stringstream data_stream(data);
     std::string line;
-
-    Clear();
-    int code_addr = 0;
-    int ram_addr = 0;
     int lineNum = 0;
+
     while(std::getline(data_stream, line))
     {
         lineNum++;
-        Instr instr;
-        instr.line = lineNum;
         size_t pos = line.find_first_of(";");
         if (pos != std::string::npos) {
             line.erase(pos);
@@ -345,128 +708,513 @@ bool Assembler::Parse(const std::string &data)
         if (std::all_of(line.begin(), line.end(), ::isspace)) continue;
 
         // Split the line
-        std::vector<std::string> lineParts = Split(line);
-        CHIP32_CHECK(instr, (lineParts.size() > 0), " not a valid line");
-
-        // Ok until now
-        std::string opcode = lineParts[0];
-
-        // =======================================================================================
-        // LABEL
-        // =======================================================================================
-        if (opcode[0] == '.')
-        {
-            CHIP32_CHECK(instr, (opcode[opcode.length() - 1] == ':') && (lineParts.size() == 1), "label must end with ':'");
-            // Label
-            opcode.pop_back(); // remove the colon character
-            instr.mnemonic = opcode;
-            instr.isLabel = true;
-            instr.addr = code_addr;
-            CHIP32_CHECK(instr, m_labels.count(opcode) == 0, "duplicated label : " + opcode);
-            m_labels[opcode] = instr;
-            m_instructions.push_back(instr);
-        }
-
-        // =======================================================================================
-        // INSTRUCTIONS
-        // =======================================================================================
-        else if (IsOpCode(opcode, instr.code))
-        {
-            instr.mnemonic = opcode;
-            bool nbArgsSuccess = false;
-            // Test nedded arguments
-            if ((instr.code.nbAargs == 0) && (lineParts.size() == 1))
+        Line l;
+        l.line = lineNum;
+        l.parts = Split(line);
+        if (l.parts.size() == 0)
+        {
+            m_lastError.line = lineNum;
+            m_lastError.message = " not a valid line";
+            return false;
+        }
+        lines.push_back(l);
+    }
+    return true;
+}
+
+// =============================================================================
+// PREPROCESSOR
+// =============================================================================
+std::map<uint64_t, std::vector<Assembler::Line>> Assembler::m_includeCache;
+std::mutex Assembler::m_includeCacheMutex;
+
+static std::string Unquote(const std::string &s)
+{
+    if ((s.size() >= 2) && (s[0] == '"') && (s[s.size() - 1] == '"'))
+    {
+        return s.substr(1, s.size() - 2);
+    }
+    return s;
+}
+
+bool Assembler::LoadInclude(const std::string &fileName, int line, std::vector<Line> &lines)
+{
+    std::ifstream f(fileName, std::ios::binary);
+    if (!f.is_open())
+    {
+        m_lastError.line = line;
+        m_lastError.message = "cannot open include file: " + fileName;
+        return false;
+    }
+    std::string buffer((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    // Shared runtime files are tokenized only once per session, whatever the file name
+    uint64_t hash = Fnv1a(buffer);
+    {
+        std::scoped_lock<std::mutex> lock(m_includeCacheMutex);
+        auto it = m_includeCache.find(hash);
+        if (it != m_includeCache.end())
+        {
+            lines = it->second;
+            return true;
+        }
+    }
+
+    if (!Tokenize(buffer, lines))
+    {
+        m_lastError.message = fileName + ", line " + std::to_string(m_lastError.line) + ": " + m_lastError.message;
+        m_lastError.line = line;
+        return false;
+    }
+
+    std::scoped_lock<std::mutex> lock(m_includeCacheMutex);
+    m_includeCache[hash] = lines;
+    return true;
+}
+
+bool Assembler::ExpandIncludes(const std::vector<Line> &input, std::vector<Line> &output, int depth)
+{
+    for (const auto &l : input)
+    {
+        if (l.parts[0] == ".include")
+        {
+            if ((l.parts.size() != 2) || (depth >= cMaxIncludeDepth))
             {
-                nbArgsSuccess = true; // no arguments, solo mnemonic
+                m_lastError.line = l.line;
+                m_lastError.message = l.parts.size() != 2 ? "usage: .include \"file\"" : "too many nested includes";
+                return false;
             }
-            else if ((instr.code.nbAargs > 0) && (lineParts.size() >= 2))
+
+            std::vector<Line> included;
+            if (!LoadInclude(Unquote(l.parts[1]), l.line, included))
             {
-                instr.args.insert(instr.args.begin(), lineParts.begin() + 1, lineParts.end());
-                CHIP32_CHECK(instr, instr.args.size() == instr.code.nbAargs,
-                             "Bad number of parameters. Required: " + std::to_string(static_cast<int>(instr.code.nbAargs)) + ", got: " + std::to_string(instr.args.size()));
-                nbArgsSuccess = true;
+                return false;
             }
-            else
+            // Included lines are reported on the .include directive line
+            for (auto &i : included)
             {
-                CHIP32_CHECK(instr, false, "Bad number of parameters");
+                i.line = l.line;
             }
 
-            if (nbArgsSuccess)
+            if (!ExpandIncludes(included, output, depth + 1))
             {
-                CHIP32_CHECK(instr, CompileMnemonicArguments(instr) == true, "Compile failure");
-                instr.addr = code_addr;
-                code_addr += 1 + instr.compiledArgs.size();
-                m_instructions.push_back(instr);
+                return false;
             }
         }
-        // =======================================================================================
-        // CONSTANTS IN ROM OR RAM (eg: $yourLabel  DC8 "a string", 5, 4, 8  (DV32 for RAM)
-        // C for Constant, V stands for Volatile
-        // =======================================================================================
-        else if (opcode[0] == '$')
+        else
         {
-            instr.mnemonic = opcode;
-            CHIP32_CHECK(instr, (lineParts.size() >= 3), "bad number of parameters");
-
-            std::string type = lineParts[1];
+            output.push_back(l);
+        }
+    }
+    return true;
+}
 
-            CHIP32_CHECK(instr, (type.size() >= 3), "bad data type size");
-            CHIP32_CHECK(instr, (type[0] == 'D') && ((type[1] == 'C') || (type[1] == 'V')), "bad data type (must be DCxx or DVxx");
-            CHIP32_CHECK(instr, m_labels.count(opcode) == 0, "duplicated label : " + opcode);
+bool Assembler::ExpandMacros(const std::vector<Line> &input, std::vector<Line> &output, int depth)
+{
+    for (const auto &l : input)
+    {
+        auto it = m_macros.find(ToLower(l.parts[0]));
+        if (it == m_macros.end())
+        {
+            output.push_back(l);
+            continue;
+        }
 
-            instr.isRomData = type[1] == 'C' ? true : false;
-            instr.isRamData = type[1] == 'V' ? true : false;
-            type.erase(0, 2);
-            instr.dataTypeSize = static_cast<uint32_t>(strtol(type.c_str(),  NULL, 0));
+        const Macro &macro = it->second;
+        if ((l.parts.size() - 1) != macro.params.size() || (depth >= cMaxMacroDepth))
+        {
+            m_lastError.line = l.line;
+            m_lastError.message = depth >= cMaxMacroDepth ? "too many nested macros: " + macro.name :
+                                      "bad number of macro parameters. Required: " + std::to_string(macro.params.size()) + ", got: " + std::to_string(l.parts.size() - 1);
+            return false;
+        }
 
-            if (instr.isRomData)
+        // \param is replaced by the argument, \@ by a unique number to make local labels
+        std::string unique = std::to_string(m_macroCounter++);
+        std::vector<Line> body = macro.body;
+        for (auto &b : body)
+        {
+            b.line = l.line;
+            for (auto &token : b.parts)
             {
-                instr.addr = code_addr;
-                m_labels[opcode] = instr; // location of the start of the data
-                // if ROM data, we generate one instruction per argument
-                // reason: arguments may be labels, easier to replace later
-
-                for (unsigned int i = 2; i < lineParts.size(); i++)
+                for (size_t i : macro.order)
                 {
-                    CHIP32_CHECK(instr, CompileConstantArgument(instr, lineParts[i]), "Compile argument error, stopping.");
-                    m_instructions.push_back(instr);
-                    code_addr += instr.compiledArgs.size();
-                    instr.addr = code_addr;
+                    ReplaceAll(token, "\\" + macro.params[i], l.parts[i + 1]);
                 }
+                ReplaceAll(token, "\\@", unique);
             }
-            else // RAM DATA, only one argument is used: the size of the array
+        }
+
+        if (!ExpandMacros(body, output, depth + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Assembler::Preprocess(std::vector<Line> &lines)
+{
+    std::vector<Line> flat;
+    if (!ExpandIncludes(lines, flat, 0))
+    {
+        return false;
+    }
+
+    // Collect macro definitions first, so a macro can be used before the file that defines it
+    std::vector<Line> code;
+    for (size_t i = 0; i < flat.size(); i++)
+    {
+        const Line &l = flat[i];
+        if (l.parts[0] == ".macro")
+        {
+            m_lastError.line = l.line;
+            m_lastError.message = "usage: .macro name param1, param2, ...";
+            if (l.parts.size() < 2)
+            {
+                return false;
+            }
+
+            Macro macro;
+            macro.name = ToLower(l.parts[1]);
+            macro.params.assign(l.parts.begin() + 2, l.parts.end());
+            // Longest names are replaced first (\count before \c)
+            for (size_t p = 0; p < macro.params.size(); p++)
+            {
+                macro.order.push_back(p);
+            }
+            std::sort(macro.order.begin(), macro.order.end(), [&macro](size_t a, size_t b) {
+                return macro.params[a].size() > macro.params[b].size();
+            });
+
+            OpCode op;
+            m_lastError.message = "invalid macro name: " + macro.name;
+            if (IsOpCode(macro.name, op) || (macro.name[0] == '.') || (macro.name[0] == '$') || (m_macros.count(macro.name) > 0))
+            {
+                return false;
+            }
+
+            for (i++; (i < flat.size()) && (flat[i].parts[0] != ".endm"); i++)
             {
-                instr.addr = ram_addr;
-                instr.dataLen = static_cast<uint16_t>(strtol(lineParts[2].c_str(),  NULL, 0));
-                ram_addr += instr.dataLen;
-                m_labels[opcode] = instr;
-                m_instructions.push_back(instr);
+                macro.body.push_back(flat[i]);
             }
+            m_lastError.message = "missing .endm for macro: " + macro.name;
+            if (i >= flat.size())
+            {
+                return false;
+            }
+            m_macros[macro.name] = macro;
         }
         else
         {
-            m_lastError.message = "Unknown mnemonic or badly formatted line";
-            m_lastError.line = lineNum;
+            code.push_back(l);
+        }
+    }
+
+    lines.clear();
+    return ExpandMacros(code, lines, 0);
+}
+
+bool Assembler::Parse(const std::string &data)
+{
+    Clear();
+    return Append(data) && Link();
+}
+
+bool Assembler::Append(const std::string &data)
+{
+    std::vector<Line> lines;
+    if (!Tokenize(data, lines) || !Preprocess(lines))
+    {
+        return false;
+    }
+
+    for (const auto &l : lines)
+    {
+        if (!AddLine(l))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Assembler::AddLine(const Line &l)
+{
+    Instr instr;
+    instr.line = l.line;
+    m_line = l.line;
+    const std::vector<std::string> &lineParts = l.parts;
+
+    // Ok until now
+    std::string opcode = lineParts[0];
+
+    // =======================================================================================
+    // LABEL
+    // =======================================================================================
+    if (opcode[0] == '.')
+    {
+        CHIP32_CHECK(instr, (opcode[opcode.length() - 1] == ':') && (lineParts.size() == 1), "label must end with ':'");
+        opcode.pop_back(); // remove the colon character
+        return AddLabel(opcode);
+    }
+
+    // =======================================================================================
+    // INSTRUCTIONS
+    // =======================================================================================
+    else if (IsOpCode(opcode, instr.code))
+    {
+        instr.mnemonic = opcode;
+        // Test nedded arguments
+        if ((instr.code.nbAargs == 0) && (lineParts.size() == 1))
+        {
+            // no arguments, solo mnemonic
+        }
+        else if ((instr.code.nbAargs > 0) && (lineParts.size() >= 2))
+        {
+            instr.args.insert(instr.args.begin(), lineParts.begin() + 1, lineParts.end());
+            CHIP32_CHECK(instr, instr.args.size() == instr.code.nbAargs,
+                         "Bad number of parameters. Required: " + std::to_string(static_cast<int>(instr.code.nbAargs)) + ", got: " + std::to_string(instr.args.size()));
+        }
+        else
+        {
+            CHIP32_CHECK(instr, false, "Bad number of parameters");
+        }
+
+        // Recorded as operands, like the instructions added without text
+        std::vector<Operand> operands;
+        CHIP32_CHECK(instr, ParseArguments(instr, operands) && EmitInstruction(instr, operands), "Compile failure");
+    }
+    // =======================================================================================
+    // CONSTANTS IN ROM OR RAM (eg: $yourLabel  DC8 "a string", 5, 4, 8  (DV32 for RAM)
+    // C for Constant, V stands for Volatile
+    // =======================================================================================
+    else if (opcode[0] == '$')
+    {
+        CHIP32_CHECK(instr, (lineParts.size() >= 3), "bad number of parameters");
+
+        std::string type = lineParts[1];
+
+        CHIP32_CHECK(instr, (type.size() >= 3), "bad data type size");
+        CHIP32_CHECK(instr, (type[0] == 'D') && ((type[1] == 'C') || (type[1] == 'V')), "bad data type (must be DCxx or DVxx");
+        bool isRom = type[1] == 'C';
+        type.erase(0, 2);
+        uint16_t typeSize = static_cast<uint16_t>(strtol(type.c_str(),  NULL, 0));
+
+        if (isRom)
+        {
+            std::vector<Operand> values;
+            for (unsigned int i = 2; i < lineParts.size(); i++)
+            {
+                const std::string &a = lineParts[i];
+                if ((a.size() > 2) && (a[0] == '"') && (a[a.size() - 1] == '"')) {
+                    values.push_back(Operand::Str(a.substr(1, a.size() - 2)));
+                } else if ((a.size() > 2) && (a[0] == '.')) {
+                    values.push_back(Operand::Lbl(a));
+                } else {
+                    values.push_back(Operand::Imm(static_cast<uint32_t>(strtol(a.c_str(),  NULL, 0))));
+                }
+            }
+            return AddRomData(opcode, typeSize, values);
+        }
+        else // RAM DATA, only one argument is used: the size of the array
+        {
+            return AddRamData(opcode, typeSize, static_cast<uint16_t>(strtol(lineParts[2].c_str(),  NULL, 0)));
+        }
+    }
+    else
+    {
+        m_lastError.message = "Unknown mnemonic or badly formatted line";
+        m_lastError.line = l.line;
+        return false;
+    }
+    return true;
+}
+
+bool Assembler::AddLabel(const std::string &label)
+{
+    if (m_recordOnly)
+    {
+        m_recorder->push_back({ Statement::Label, label, OP_NOP, 0, 0, {} });
+        return true;
+    }
+
+    Instr instr;
+    instr.line = m_line;
+    instr.mnemonic = label;
+    instr.isLabel = true;
+    CHIP32_CHECK(instr, (label.size() > 1) && (label[0] == '.'), "label must start with '.': " + label);
+    CHIP32_CHECK(instr, m_labels.count(label) == 0, "duplicated label : " + label);
+    m_labels[label] = instr;
+    m_instructions.push_back(instr);
+    if (m_recorder != nullptr)
+    {
+        m_recorder->push_back({ Statement::Label, label, OP_NOP, 0, 0, {} });
+    }
+    return true;
+}
+
+bool Assembler::AddInstruction(chip32_instruction_t op, const std::vector<Operand> &args)
+{
+    Instr instr;
+    instr.line = m_line;
+    CHIP32_CHECK(instr, op < INSTRUCTION_COUNT, "Unsupported instruction: " + std::to_string(op));
+    instr.code = OpCodes[op];
+    instr.mnemonic = Mnemonics[op];
+    return EmitInstruction(instr, args);
+}
+
+bool Assembler::EmitInstruction(Instr &instr, const std::vector<Operand> &args)
+{
+    // Opcode given before the encoding, which selects the smallest lcons/jump variant
+    chip32_instruction_t op = static_cast<chip32_instruction_t>(instr.code.opcode);
+    if (m_recordOnly)
+    {
+        m_recorder->push_back({ Statement::Instruction, "", op, 0, 0, args });
+        return true;
+    }
+    if (!Encode(instr, args))
+    {
+        return false;
+    }
+    m_instructions.push_back(std::move(instr));
+    if (m_recorder != nullptr)
+    {
+        m_recorder->push_back({ Statement::Instruction, "", op, 0, 0, args });
+    }
+    return true;
+}
+
+bool Assembler::AddRomData(const std::string &label, uint16_t typeSize, const std::vector<Operand> &values)
+{
+    if (m_recordOnly)
+    {
+        m_recorder->push_back({ Statement::RomData, label, OP_NOP, typeSize, 0, values });
+        return true;
+    }
+
+    Instr instr;
+    instr.line = m_line;
+    instr.mnemonic = label;
+    instr.isRomData = true;
+    instr.dataTypeSize = typeSize;
+    CHIP32_CHECK(instr, (label.size() > 1) && (label[0] == '$'), "constant label must start with '$': " + label);
+    CHIP32_CHECK(instr, values.size() > 0, "bad number of parameters");
+
+    Instr labelInstr = instr; // location of the start of the data
+    // One instruction per value
+    // reason: values may be labels, easier to replace later
+    std::vector<Instr> data;
+    std::string key = std::to_string(typeSize) + ":";
+
+    for (const auto &v : values)
+    {
+        CHIP32_CHECK(instr, CompileConstantArgument(instr, v), "Compile argument error, stopping.");
+        data.push_back(instr);
+        // Labels are resolved later, so they are part of the key by name
+        if (instr.useLabel) {
+            key += "L" + instr.label + '\0';
+        } else {
+            key += "D" + std::string(instr.compiledArgs.begin(), instr.compiledArgs.end());
+        }
+    }
+
+    // Same ROM constant declared again (eg: same asset used by many nodes) is merged by the constant pool
+    CHIP32_CHECK(instr, AddConstant(label, key, labelInstr, data), "duplicated label : " + label);
+    if (m_recorder != nullptr)
+    {
+        m_recorder->push_back({ Statement::RomData, label, OP_NOP, typeSize, 0, values });
+    }
+    return true;
+}
+
+bool Assembler::AddRamData(const std::string &label, uint16_t typeSize, uint16_t count)
+{
+    if (m_recordOnly)
+    {
+        m_recorder->push_back({ Statement::RamData, label, OP_NOP, typeSize, count, {} });
+        return true;
+    }
+
+    Instr instr;
+    instr.line = m_line;
+    instr.mnemonic = label;
+    instr.isRamData = true;
+    instr.dataTypeSize = typeSize;
+    instr.dataLen = count;
+    CHIP32_CHECK(instr, (label.size() > 1) && (label[0] == '$'), "variable label must start with '$': " + label);
+    CHIP32_CHECK(instr, m_labels.count(label) == 0, "duplicated label : " + label);
+
+    instr.addr = m_ramAddr;
+    m_ramAddr += count;
+    m_labels[label] = instr;
+    m_instructions.push_back(instr);
+    if (m_recorder != nullptr)
+    {
+        m_recorder->push_back({ Statement::RamData, label, OP_NOP, typeSize, count, {} });
+    }
+    return true;
+}
+
+bool Assembler::Replay(const std::vector<Statement> &statements)
+{
+    for (const auto &s : statements)
+    {
+        bool success = false;
+        switch (s.type)
+        {
+        case Statement::Label:
+            success = AddLabel(s.label);
+            break;
+        case Statement::Instruction:
+            success = AddInstruction(s.op, s.args);
+            break;
+        case Statement::RomData:
+            success = AddRomData(s.label, s.typeSize, s.args);
+            break;
+        case Statement::RamData:
+            success = AddRamData(s.label, s.typeSize, s.count);
+            break;
+        }
+
+        if (!success)
+        {
             return false;
         }
     }
+    return true;
+}
+
+bool Assembler::Link()
+{
+    // 2. Second pass: choose the smallest encoding of each instruction using a label
+    if (!Relax())
+    {
+        return false;
+    }
 
-    // 2. Second pass: replace all label or RAM data by the real address in memory
+    // 3. Third pass: replace all label or RAM data by the real address in memory
     for (auto &instr : m_instructions)
     {
-        if (instr.useLabel && (instr.args.size() > 0))
+        if (instr.useLabel)
         {
             // label is the first argument for jump, second position for LCONS
-            uint16_t argsIndex = instr.code.opcode == OP_LCONS ? 1 : 0;
-            std::string label = instr.args[argsIndex];
-            CHIP32_CHECK(instr, m_labels.count(label) > 0, "label not found: " + label);
-            uint16_t addr = m_labels[label].addr;
-            std::cout << "LABEL: " << label << " , addr: " << addr << std::endl;
-            instr.compiledArgs[argsIndex] = addr & 0xFF;
-            instr.compiledArgs[argsIndex+1] = (addr >> 8U) & 0xFF;
+            uint16_t argsIndex = IsLcons(instr) ? 1 : 0;
+            uint16_t addr = instr.target->addr;
+
+            if (instr.code.opcode == OP_JUMPS)
+            {
+                instr.compiledArgs[0] = static_cast<uint8_t>(JumpOffset(instr, addr));
+            }
+            else
+            {
+                instr.compiledArgs[argsIndex] = addr & 0xFF;
+                instr.compiledArgs[argsIndex+1] = (addr >> 8U) & 0xFF;
+            }
+
             if (instr.code.opcode == OP_LCONS) {
                 // We precise if the address is from RAM or ROM
-                instr.compiledArgs[argsIndex+3] = m_labels[label].isRamData ? 0x80 : 0;
+                instr.compiledArgs[argsIndex+3] = instr.target->isRamData ? 0x80 : 0;
             }
         }
     }
@@ -474,4 +1222,140 @@ bool Assembler::Parse(const std::string &data)
     return true;
 }
 
+
+bool Assembler::AddConstant(const std::string &label, const std::string &key, const Instr &labelInstr, std::vector<Instr> &data)
+{
+    uint32_t size = 0;
+    for (const auto &d : data)
+    {
+        size += d.compiledArgs.size();
+    }
+
+    if (m_labels.count(label) > 0)
+    {
+        // Only accepted if this is exactly the same constant
+        auto k = m_constantKeys.find(label);
+        if ((k == m_constantKeys.end()) || (k->second != key))
+        {
+            return false;
+        }
+        m_pooledBytes += size;
+        return true;
+    }
+
+    auto pooled = m_constantPool.emplace(key, label);
+    if (!pooled.second)
+    {
+        // Same content already stored in ROM under another name, share it
+        m_labels[label] = m_labels[pooled.first->second];
+        m_aliases[label] = pooled.first->second;
+        m_pooledBytes += size;
+    }
+    else
+    {
+        m_labels[label] = labelInstr;
+        m_instructions.insert(m_instructions.end(), std::make_move_iterator(data.begin()), std::make_move_iterator(data.end()));
+    }
+    m_constantKeys[label] = key;
+    return true;
+}
+
+bool Assembler::IsLcons(const Instr &instr)
+{
+    return instr.isRomCode() && ((instr.code.opcode == OP_LCONS) ||
+                                 (instr.code.opcode == OP_LCONS8) ||
+                                 (instr.code.opcode == OP_LCONS16));
+}
+
+int Assembler::JumpOffset(const Instr &instr, uint16_t target)
+{
+    // Short jumps are relative to the next instruction
+    return static_cast<int>(target) - static_cast<int>(instr.addr + 1 + instr.compiledArgs.size());
+}
+
+void Assembler::AssignAddresses()
+{
+    uint16_t code_addr = 0;
+    std::string currentData;
+
+    for (auto &instr : m_instructions)
+    {
+        if (instr.isRamData)
+        {
+            continue; // RAM addresses do not depend on the code size
+        }
+
+        instr.addr = code_addr;
+        if (instr.isLabel)
+        {
+            m_labels[instr.mnemonic].addr = code_addr;
+        }
+        else if (instr.isRomData)
+        {
+            // One instruction per argument, the label points to the first one
+            if (instr.mnemonic != currentData)
+            {
+                m_labels[instr.mnemonic].addr = code_addr;
+                currentData = instr.mnemonic;
+            }
+            code_addr += instr.compiledArgs.size();
+        }
+        else
+        {
+            code_addr += 1 + instr.compiledArgs.size();
+        }
+    }
+
+    for (const auto &alias : m_aliases)
+    {
+        m_labels[alias.first].addr = m_labels[alias.second].addr;
+    }
+}
+
+bool Assembler::Relax()
+{
+    // Label references are checked first, RAM labels need the 32-bit LCONS form (RAM bit in the MSB)
+    for (auto &instr : m_instructions)
+    {
+        if (instr.useLabel)
+        {
+            const std::string &label = instr.label;
+            auto it = m_labels.find(label);
+            CHIP32_CHECK(instr, it != m_labels.end(), "label not found: " + label);
+            instr.target = &it->second;
+
+            if (IsLcons(instr) && instr.target->isRamData)
+            {
+                instr.code = OpCodes[OP_LCONS];
+                instr.compiledArgs.resize(5);
+            }
+        }
+    }
+
+    // Jumps start in the short form and are promoted when the target is out of range.
+    // Instructions can only grow, so the loop ends after a few iterations.
+    bool changed = false;
+    do
+    {
+        changed = false;
+        AssignAddresses();
+
+        for (auto &instr : m_instructions)
+        {
+            if (instr.isRomCode() && (instr.code.opcode == OP_JUMPS))
+            {
+                int offset = JumpOffset(instr, instr.target->addr);
+                if ((offset < INT8_MIN) || (offset > INT8_MAX))
+                {
+                    instr.code = OpCodes[OP_JUMP];
+                    instr.compiledArgs.assign(2, 0);
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    return true;
+}
+
 } // namespace Chip32
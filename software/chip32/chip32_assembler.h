@@ -30,7 +30,9 @@ THE SOFTWARE.
 #include <cstdint>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <iostream>
+#include <mutex>
 
 namespace Chip32
 {
@@ -54,6 +56,10 @@ struct Instr {
     bool useLabel{false}; //!< If true, the instruction uses a label
     bool isRomData{false}; //!< True is constant data in program
     bool isRamData{false}; //!< True is constant data in program
+    bool isString{false}; //!< ROM data is a null terminated string
+
+    std::string label; //!< Label used by the instruction (useLabel is true)
+    Instr *target{nullptr}; //!< Entry of the label in the label table, set when linking
 
     uint16_t addr{0}; //!< instruction address when assembled in program memory
 
@@ -66,11 +72,46 @@ struct RegNames
     std::string name;
 };
 
+// Argument of the direct code generation API (no assembly text)
+struct Operand
+{
+    enum Type { Register, Immediate, Label, String };
+
+    Type type{Immediate};
+    uint32_t value{0}; //!< register number or immediate value
+    std::string text; //!< label name or string content
+
+    static Operand Reg(chip32_register_t reg) { return { Register, static_cast<uint32_t>(reg), "" }; }
+    static Operand Imm(uint32_t value) { return { Immediate, value, "" }; }
+    static Operand Lbl(const std::string &label) { return { Label, 0, label }; }
+    static Operand Str(const std::string &text) { return { String, 0, text }; }
+
+    bool operator==(const Operand &o) const { return (type == o.type) && (value == o.value) && (text == o.text); }
+};
+
+// Statement of the direct code generation API, recorded to be replayed later (eg: build cache)
+struct Statement
+{
+    enum Type { Label, Instruction, RomData, RamData };
+
+    Type type{Instruction};
+    std::string label;
+    chip32_instruction_t op{OP_NOP};
+    uint16_t typeSize{0};
+    uint16_t count{0};
+    std::vector<Operand> args;
+
+    bool operator==(const Statement &o) const {
+        return (type == o.type) && (op == o.op) && (typeSize == o.typeSize) && (count == o.count) && (label == o.label) && (args == o.args);
+    }
+};
+
 struct Result
 {
     int ramUsageSize{0};
     int romUsageSize{0};
     int constantsSize{0};
+    int pooledSize{0}; //!< ROM bytes saved by sharing identical constants
 
     void Print()
     {
@@ -78,6 +119,7 @@ struct Result
                   << "IMAGE size: " << romUsageSize << " bytes\n"
                   << "   -> ROM DATA: " << constantsSize << " bytes\n"
                   << "   -> ROM CODE: " << romUsageSize - constantsSize << "\n"
+                  << "CONSTANT POOL: " << pooledSize << " bytes saved\n"
                   << std::endl;
 
     }
@@ -95,12 +137,44 @@ public:
 
     // Separated parser to allow only code check
     bool Parse(const std::string &data);
+
+    // Direct code generation: Clear(), then add labels, instructions and data to the
+    // program without any text, then Link(). Assembly text can be mixed in with Append().
+    bool AddLabel(const std::string &label);
+    bool AddInstruction(chip32_instruction_t op, const std::vector<Operand> &args = {});
+    bool AddRomData(const std::string &label, uint16_t typeSize, const std::vector<Operand> &values);
+    bool AddRamData(const std::string &label, uint16_t typeSize, uint16_t count);
+    bool Append(const std::string &data);
+    // Record the statements added to the program, nullptr to stop recording.
+    // recordOnly: the statements are only recorded, they are checked and encoded when replayed.
+    void SetRecorder(std::vector<Statement> *recorder, bool recordOnly = false) {
+        m_recorder = recorder;
+        m_recordOnly = recordOnly && (recorder != nullptr);
+    }
+    bool Replay(const std::vector<Statement> &statements);
+    // Select the encodings and resolve the labels, the program is then ready for BuildBinary()
+    bool Link();
     // Generate the executable binary after the parse pass
     bool BuildBinary(std::vector<uint8_t> &program, Result &result);
+    // Map file (JSON) of every label: address, section and size, with code/data totals per node
+    void GenerateMap(std::ostream &out);
+    // Annotated listing: address, bytes and source line of each instruction
+    void GenerateListing(std::ostream &out);
+    // Assembly source of the program, one line per statement. The line of each
+    // instruction is updated to match this text (for the debugger and error reporting).
+    void GenerateSource(std::ostream &out);
 
     void Clear() {
+        m_macros.clear();
+        m_macroCounter = 0;
+        m_line = 0;
+        m_ramAddr = 0;
         m_labels.clear();
         m_instructions.clear();
+        m_constantPool.clear();
+        m_constantKeys.clear();
+        m_aliases.clear();
+        m_pooledBytes = 0;
     }
 
     std::vector<Instr>::const_iterator Begin() { return m_instructions.begin(); }
@@ -111,17 +185,71 @@ public:
     bool GetRegisterName(uint8_t reg, std::string &regName);
 
     Error GetLastError() { return m_lastError; }
+    void SetLastError(const Error &error) { m_lastError = error; }
 
 private:
-    bool CompileMnemonicArguments(Instr &instr);
+    // Tokenized source line
+    struct Line {
+        int line{0};
+        std::vector<std::string> parts;
+    };
+
+    struct Macro {
+        std::string name;
+        std::vector<std::string> params;
+        std::vector<size_t> order; //!< parameter indexes, substitution order
+        std::vector<Line> body;
+    };
+
+    static const int cMaxIncludeDepth = 8;
+    static const int cMaxMacroDepth = 16;
+
+    bool ParseArguments(Instr &instr, std::vector<Operand> &operands);
+    bool Encode(Instr &instr, const std::vector<Operand> &args);
+    // Encodes, adds and records an instruction (text or direct code generation)
+    bool EmitInstruction(Instr &instr, const std::vector<Operand> &args);
+    bool AddLine(const Line &l);
+    std::string ArgumentsText(const Instr &instr);
+
+    // Preprocessor: .include "file" and .macro name params ... .endm
+    bool Tokenize(const std::string &data, std::vector<Line> &lines);
+    bool Preprocess(std::vector<Line> &lines);
+    bool ExpandIncludes(const std::vector<Line> &input, std::vector<Line> &output, int depth);
+    bool ExpandMacros(const std::vector<Line> &input, std::vector<Line> &output, int depth);
+    bool LoadInclude(const std::string &fileName, int line, std::vector<Line> &lines);
+
+    std::map<std::string, Macro> m_macros;
+    uint32_t m_macroCounter{0};
+
+    // Session cache of tokenized include files, key is a hash of the file content
+    static std::map<uint64_t, std::vector<Line>> m_includeCache;
+    static std::mutex m_includeCacheMutex;
 
     // label, address
-    std::map<std::string, Instr> m_labels;
+    std::unordered_map<std::string, Instr> m_labels;
 
     Error m_lastError;
 
     std::vector<Instr> m_instructions;
-    bool CompileConstantArgument(Instr &instr, const std::string &a);
+    bool CompileConstantArgument(Instr &instr, const Operand &value);
+
+    int m_line{0}; //!< source line of the statement being added
+    std::vector<Statement> *m_recorder{nullptr};
+    bool m_recordOnly{false};
+    uint16_t m_ramAddr{0};
+
+    // ROM constant pool: identical constants are stored once
+    std::unordered_map<std::string, std::string> m_constantPool; //!< content key -> label of the stored constant
+    std::unordered_map<std::string, std::string> m_constantKeys; //!< label -> content key
+    std::map<std::string, std::string> m_aliases; //!< label -> label of the shared constant, sorted for the map file
+    uint32_t m_pooledBytes{0};
+    bool AddConstant(const std::string &label, const std::string &key, const Instr &labelInstr, std::vector<Instr> &data);
+
+    // Relaxation pass: select the compact encodings and compute the final addresses
+    bool Relax();
+    void AssignAddresses();
+    static bool IsLcons(const Instr &instr);
+    static int JumpOffset(const Instr &instr, uint16_t target);
 };
 
 }
@@ -0,0 +1,82 @@
+/*
+The MIT License
+
+Copyright (c) 2022 Anthony Rabine
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <fstream>
+#include <filesystem>
+#include "catch.hpp"
+#include "asset_store.h"
+
+/*
+Purpose: references of the stories to the shared assets, set when their project is saved
+*/
+
+static std::filesystem::path WriteAsset(const std::filesystem::path &dir, const std::string &name, const std::string &content)
+{
+    std::filesystem::path file = dir / name;
+    std::ofstream o(file, std::ios::binary);
+    o << content;
+    return file;
+}
+
+TEST_CASE( "Asset store references follow the saved projects" ) {
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "chip32_test_asset_store";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    AssetStore store;
+    store.Initialize(dir.string());
+
+    // Imported, not referenced until a project is saved
+    std::string fairy = store.Import(WriteAsset(dir, "fairy.png", "fairy"));
+    std::string castle = store.Import(WriteAsset(dir, "castle.png", "castle"));
+    REQUIRE( fairy.size() == 64 );
+    REQUIRE( store.Import(WriteAsset(dir, "fairy2.png", "fairy")) == fairy );
+    REQUIRE( store.References(fairy) == 0 );
+
+    store.SetReferences("story-a", { fairy, castle });
+    store.SetReferences("story-b", { fairy });
+    // Saved twice: one reference per story
+    store.SetReferences("story-b", { fairy });
+    REQUIRE( store.References(fairy) == 2 );
+    REQUIRE( store.References(castle) == 1 );
+
+    // Resource deleted then project saved: the last reference deletes the object
+    store.SetReferences("story-a", { fairy });
+    REQUIRE( store.References(castle) == 0 );
+    REQUIRE( store.Link(castle, dir / "castle_link.png") == false );
+    REQUIRE( store.References(fairy) == 2 );
+    REQUIRE( store.Link(fairy, dir / "fairy_link.png") );
+
+    // An object imported by a project never saved is removed at the next start
+    std::string forest = store.Import(WriteAsset(dir, "forest.png", "forest"));
+    REQUIRE( store.Link(forest, dir / "forest_link.png") );
+    AssetStore restarted;
+    restarted.Initialize(dir.string());
+    REQUIRE( restarted.Link(forest, dir / "forest_link2.png") == false );
+    REQUIRE( restarted.References(fairy) == 2 );
+
+    std::filesystem::remove_all(dir);
+}
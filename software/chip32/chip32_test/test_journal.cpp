@@ -0,0 +1,74 @@
+/*
+The MIT License
+
+Copyright (c) 2022 Anthony Rabine
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <filesystem>
+#include "catch.hpp"
+#include "project_journal.h"
+
+/*
+Purpose: node graph changes recorded in the project journal and replayed over the saved graph
+*/
+
+static nlohmann::json MakeNode(int id, float x)
+{
+    return { { "id", id }, { "type", "media-node" }, { "position", { { "x", x }, { "y", 0.0f } } } };
+}
+
+TEST_CASE( "Journal replay of created nodes" ) {
+
+    std::filesystem::path fileName = std::filesystem::temp_directory_path() / "chip32_test_project.journal";
+    std::filesystem::remove(fileName);
+
+    // Saved graph with one node
+    nlohmann::json model;
+    model["nodes"] = nlohmann::json::array({ MakeNode(1, 10.0f) });
+    model["connections"] = nlohmann::json::array();
+
+    nlohmann::json link = { { "outNodeId", 2 }, { "outPortIndex", 0 }, { "inNodeId", 3 }, { "inPortIndex", 0 } };
+    {
+        // Two nodes created after the save, then linked and the second one moved
+        ProjectJournal journal;
+        journal.Open(fileName);
+        journal.NodeChanged(MakeNode(2, 20.0f));
+        journal.NodeChanged(MakeNode(3, 30.0f));
+        journal.LinkAdded(link);
+        journal.NodeChanged(MakeNode(3, 35.0f));
+        REQUIRE( journal.Entries() == 4 );
+    }
+
+    REQUIRE( ProjectJournal::Replay(fileName, model) == 4 );
+    REQUIRE( model["nodes"].size() == 3 );
+    REQUIRE( model["nodes"][0] == MakeNode(1, 10.0f) ); // The saved node is kept
+    REQUIRE( model["nodes"][1] == MakeNode(2, 20.0f) );
+    REQUIRE( model["nodes"][2] == MakeNode(3, 35.0f) );
+    REQUIRE( model["connections"].size() == 1 );
+    REQUIRE( model["connections"][0] == link );
+
+    // Replayed again after a crash before the next save: same graph
+    REQUIRE( ProjectJournal::Replay(fileName, model) == 4 );
+    REQUIRE( model["nodes"].size() == 3 );
+    REQUIRE( model["connections"].size() == 1 );
+
+    std::filesystem::remove(fileName);
+}
@@ -26,6 +26,9 @@ THE SOFTWARE.
 
 #include "catch.hpp"
 #include "chip32_assembler.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
 
 /*
 Purpose: grammar, ram usage and macros, rom code generation
@@ -48,12 +51,13 @@ $MyArray            DV8    10 ; array of 10 bytes
 ; We create a stupid loop just for RAM variable testing
 
     lcons r0, 4 ; prepare loop: 4 iterations
-    store $RamData1, r0 ; save R0 in RAM
+    lcons r2, $RamData1
+    store @r2, r0, 4 ; save R0 in RAM
     lcons r1, 1
 .loop:
-    load r0, $RamData1  ; load this variable
+    load r0, @r2, 4  ; load this variable
     sub r0, r1
-    store $RamData1, r0 ; save R0 in RAM
+    store @r2, r0, 4 ; save R0 in RAM
     skipz r0   ; skip loop if R0 == 0
     jump .loop
 
@@ -68,8 +72,8 @@ mov R0,R2  ; copy R2 into R0 (NO blank space between , and R2)
 TEST_CASE( "Check various indentations and typos" ) {
 
     std::vector<uint8_t> program;
-    Chip32Assembler assembler;
-    AssemblyResult result;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
     uint8_t data[8*1024];
 
     REQUIRE( assembler.Parse(test1) == true );
@@ -79,18 +83,390 @@ TEST_CASE( "Check various indentations and typos" ) {
     hexdump(program.data(), program.size());
 
     // ---------  EXECUTE BINARY  ---------
-    virtual_mem_t rom = {
-        .mem = program.data(),
-        .size = 8*1024,
-        .addr = 0
-    };
-    virtual_mem_t ram = {
-        .mem = data,
-        .size = sizeof(data),
-        .addr = 40 *1024
-    };
-
-    chip32_initialize(&rom, &ram, 256);
-    chip32_result_t runResult = chip32_run(program.size(), 1000);
+    chip32_ctx_t ctx;
+    ctx.rom.mem = program.data();
+    ctx.rom.size = program.size();
+    ctx.rom.addr = 0;
+    ctx.ram.mem = data;
+    ctx.ram.size = sizeof(data);
+    ctx.ram.addr = 40 * 1024;
+    ctx.stack_size = 256;
+    ctx.max_instr = 1000;
+    ctx.syscall = nullptr;
+
+    chip32_initialize(&ctx);
+    chip32_result_t runResult = chip32_run(&ctx);
     REQUIRE( runResult == VM_FINISHED );
 }
+
+static const std::string testCompact = R"(
+    jump .entry
+$someText   DC8 "hello", 8
+$RamData1   DV32 1
+.entry:
+    lcons r0, 0x12        ; 8-bit immediate
+    lcons r1, 0x1234      ; 16-bit immediate
+    lcons r2, 0x12345678  ; 32-bit immediate
+    lcons r3, $someText   ; ROM address, 16-bit
+    lcons r4, $RamData1   ; RAM address, 32-bit
+    jump .end
+.end:
+    halt
+)";
+
+TEST_CASE( "Smallest encodings are selected" ) {
+
+    std::vector<uint8_t> program;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(testCompact) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true);
+    hexdump(program.data(), program.size());
+
+    std::vector<uint8_t> expected;
+    for (auto it = assembler.Begin(); it != assembler.End(); ++it)
+    {
+        if (it->isRomCode())
+        {
+            expected.push_back(it->code.opcode);
+        }
+    }
+
+    REQUIRE( expected == std::vector<uint8_t>{ OP_JUMPS, OP_LCONS8, OP_LCONS16, OP_LCONS, OP_LCONS16, OP_LCONS, OP_JUMPS, OP_HALT } );
+    // jump + "hello"/8 + lcons8 + lcons16 + lcons + lcons16 + lcons + jumps + halt
+    REQUIRE( program.size() == 2 + 7 + 3 + 4 + 6 + 4 + 6 + 2 + 1 );
+}
+
+TEST_CASE( "Far jumps are promoted to absolute addresses" ) {
+
+    std::string code = "    jump .end\n";
+    for (int i = 0; i < 100; i++)
+    {
+        code += "    mov r0, r1\n";
+    }
+    code += ".end:\n    jump .end\n    halt\n";
+
+    std::vector<uint8_t> program;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(code) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true);
+
+    // First jump is 303 bytes away, the last one is a short backward jump on itself
+    REQUIRE( program[0] == OP_JUMP );
+    REQUIRE( program[1] == (303 & 0xFF) );
+    REQUIRE( program[2] == (303 >> 8) );
+    REQUIRE( program[303] == OP_JUMPS );
+    REQUIRE( static_cast<int8_t>(program[304]) == -2 );
+}
+
+static const std::string testPool = R"(
+    jump .entry
+$fairy      DC8 "fairy.qoi", 8
+$fairy      DC8 "fairy.qoi", 8  ; same asset used by another node
+$copy       DC8 "fairy.qoi", 8  ; same content, other name
+$other      DC8 "other.qoi", 8
+.entry:
+    lcons r0, $fairy
+    lcons r1, $copy
+    lcons r2, $other
+    halt
+)";
+
+TEST_CASE( "Identical ROM constants are stored once" ) {
+
+    std::vector<uint8_t> program;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(testPool) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true);
+    result.Print();
+
+    // "fairy.qoi" + zero + 8
+    REQUIRE( result.pooledSize == 2 * 11 );
+    REQUIRE( program.size() == 2 + 11 + 11 + 3 * 4 + 1 );
+
+    // Both labels point to the same ROM address
+    REQUIRE( program[2 + 22 + 2] == program[2 + 22 + 4 + 2] );
+    REQUIRE( program[2 + 22 + 3] == program[2 + 22 + 4 + 3] );
+    REQUIRE( program[2 + 22 + 2] == 2 );
+}
+
+TEST_CASE( "Duplicated label with a different content is an error" ) {
+
+    Chip32::Assembler assembler;
+
+    REQUIRE( assembler.Parse("$a DC8 \"one\"\n$a DC8 \"two\"\n    halt\n") == false );
+    REQUIRE( assembler.Parse("$a DC8 \"one\"\n$a DV8 4\n    halt\n") == false );
+}
+
+TEST_CASE( "Include files and macros" ) {
+
+    const std::string includeFile = (std::filesystem::temp_directory_path() / "chip32_test_include.asm").string();
+    {
+        std::ofstream f(includeFile);
+        f << "; shared runtime\n"
+          << ".macro setmedia image, sound\n"
+          << "    lcons r0, \\image\n"
+          << "    lcons r1, \\sound\n"
+          << ".endm\n"
+          << ".macro countdown reg\n"
+          << ".loop\\@:\n"
+          << "    sub \\reg, r9\n"
+          << "    skipz \\reg\n"
+          << "    jump .loop\\@\n"
+          << ".endm\n"
+          << ".routine:\n"
+          << "    ret\n";
+    }
+
+    const std::string include = "    .include \"" + includeFile + "\"\n";
+    const std::string code = R"(
+    lcons r9, 1
+    lcons r2, 3
+    setmedia 5, 0x1234
+    countdown r2
+    lcons r3, 2
+    countdown r3
+    halt
+)" + include;
+
+    std::vector<uint8_t> program;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(code) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+
+    std::vector<uint8_t> expected;
+    int labels = 0;
+    for (auto it = assembler.Begin(); it != assembler.End(); ++it)
+    {
+        if (it->isRomCode())
+        {
+            expected.push_back(it->code.opcode);
+        }
+        else if (it->isLabel)
+        {
+            labels++;
+            // Included and expanded code is reported on the calling line
+            REQUIRE( ((it->line == 5) || (it->line == 7) || (it->line == 9)) );
+        }
+    }
+    REQUIRE( labels == 3 ); // two expanded local loops + included routine
+    REQUIRE( expected == std::vector<uint8_t>{ OP_LCONS8, OP_LCONS8, OP_LCONS8, OP_LCONS16,
+                                               OP_SUB, OP_SKIPZ, OP_JUMPS,
+                                               OP_LCONS8, OP_SUB, OP_SKIPZ, OP_JUMPS,
+                                               OP_HALT, OP_RET } );
+
+    // Second parse uses the include cache
+    REQUIRE( assembler.Parse(code) == true );
+
+    REQUIRE( assembler.Parse("    setmedia 1\n" + include) == false );
+    REQUIRE( assembler.Parse("    .include \"missing_file.asm\"\n") == false );
+    REQUIRE( assembler.GetLastError().line == 1 );
+
+    std::filesystem::remove(includeFile);
+}
+
+TEST_CASE( "Map file and listing" ) {
+
+    static const std::string code = R"(
+.mediaEntry0001:
+    lcons r0, $fairy
+    lcons r1, $fairy2
+    lcons r2, $choice
+    halt
+.mediaEntry0002:
+    lcons r0, $fairy
+    halt
+.global:
+    ret
+$fairy  DC8 "fairy.qoi", 8
+$fairy2 DC8 "fairy.qoi", 8
+$choice DC32, 2, .mediaEntry0001, .mediaEntry0002
+$counter DV32 1
+)";
+
+    std::vector<uint8_t> program;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(code) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+
+    std::stringstream map;
+    assembler.GenerateMap(map);
+    std::string json = map.str();
+
+    // 3 x lcons16 + halt, lcons16 + halt, ret: 13 + 5 + 1 bytes
+    REQUIRE( json.find("\"rom\": { \"size\": " + std::to_string(program.size()) + ", \"code\": 19, \"data\": 23, \"pooled\": 11 }") != std::string::npos );
+    REQUIRE( json.find("{ \"name\": \".mediaEntry0001\", \"section\": \"code\", \"address\": 0, \"size\": 13 }") != std::string::npos );
+    REQUIRE( json.find("{ \"name\": \"$fairy2\", \"section\": \"data\", \"address\": 19, \"size\": 11, \"alias\": \"$fairy\" }") != std::string::npos );
+    REQUIRE( json.find("{ \"name\": \"$counter\", \"section\": \"ram\", \"address\": 0, \"size\": 4 }") != std::string::npos );
+    REQUIRE( json.find("{ \"name\": \".mediaEntry0001\", \"address\": 0, \"code\": 13, \"data\": 23, \"total\": 36, \"constants\": [\"$choice\", \"$fairy\"] }") != std::string::npos );
+    REQUIRE( json.find("{ \"name\": \".mediaEntry0002\", \"address\": 13, \"code\": 5, \"data\": 11, \"total\": 16, \"constants\": [\"$fairy\"] }") != std::string::npos );
+
+    std::stringstream listing;
+    assembler.GenerateListing(listing);
+    REQUIRE( listing.str().find(" 0013   66 61 69 72 79 2E 71 6F   ") != std::string::npos );
+}
+
+TEST_CASE( "Direct code generation" ) {
+
+    static const std::string code = R"(
+    jump .mediaEntry0001
+$fairy  DC8 "fairy.qoi", 8
+$choice DC32, 2, .mediaEntry0001, .mediaEntry0002
+$counter DV32 1
+.mediaEntry0001:
+    lcons r0, $fairy
+    lcons r1, 0
+    syscall 1
+    lcons r0, $choice
+    jump .mediaEntry0002
+.mediaEntry0002:
+    lcons r2, $counter
+    load r3, @r2, 4
+    add r3, r1
+    store @r2, r3, 4
+    halt
+)";
+
+    using Chip32::Operand;
+    std::vector<uint8_t> program;
+    std::vector<uint8_t> expected;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.Parse(code) == true );
+    REQUIRE( assembler.BuildBinary(expected, result) == true );
+
+    assembler.Clear();
+    REQUIRE( assembler.AddInstruction(OP_JUMP, { Operand::Lbl(".mediaEntry0001") }) );
+    REQUIRE( assembler.AddRomData("$fairy", 8, { Operand::Str("fairy.qoi"), Operand::Imm(8) }) );
+    REQUIRE( assembler.AddRomData("$choice", 32, { Operand::Imm(2), Operand::Lbl(".mediaEntry0001"), Operand::Lbl(".mediaEntry0002") }) );
+    REQUIRE( assembler.AddRamData("$counter", 32, 1) );
+    REQUIRE( assembler.AddLabel(".mediaEntry0001") );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$fairy") }) );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R1), Operand::Imm(0) }) );
+    REQUIRE( assembler.AddInstruction(OP_SYSCALL, { Operand::Imm(1) }) );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$choice") }) );
+    REQUIRE( assembler.AddInstruction(OP_JUMP, { Operand::Lbl(".mediaEntry0002") }) );
+    REQUIRE( assembler.AddLabel(".mediaEntry0002") );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R2), Operand::Lbl("$counter") }) );
+    REQUIRE( assembler.AddInstruction(OP_LOAD, { Operand::Reg(R3), Operand::Reg(R2), Operand::Imm(4) }) );
+    REQUIRE( assembler.AddInstruction(OP_ADD, { Operand::Reg(R3), Operand::Reg(R1) }) );
+    REQUIRE( assembler.AddInstruction(OP_STORE, { Operand::Reg(R2), Operand::Reg(R3), Operand::Imm(4) }) );
+    REQUIRE( assembler.AddInstruction(OP_HALT) );
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+    REQUIRE( program == expected );
+
+    // The generated source assembles to the same program, its lines are used by the debugger
+    std::stringstream source;
+    assembler.GenerateSource(source);
+    REQUIRE( assembler.Begin()->line == 1 );
+    REQUIRE( assembler.Parse(source.str()) == true );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+    REQUIRE( program == expected );
+
+    // Errors are reported by the API
+    assembler.Clear();
+    REQUIRE( assembler.AddInstruction(OP_MOV, { Operand::Reg(R0), Operand::Imm(2) }) == false );
+    REQUIRE( assembler.AddInstruction(OP_JUMP, { Operand::Reg(R0) }) == false );
+    REQUIRE( assembler.AddLabel("missing_dot") == false );
+    REQUIRE( assembler.AddInstruction(OP_JUMP, { Operand::Lbl(".nowhere") }) );
+    REQUIRE( assembler.Link() == false );
+}
+
+TEST_CASE( "Recorded statements are replayed" ) {
+
+    using Chip32::Operand;
+    std::vector<uint8_t> program;
+    std::vector<uint8_t> expected;
+    std::vector<Chip32::Statement> statements;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    assembler.SetRecorder(&statements);
+    REQUIRE( assembler.AddRomData("$fairy", 8, { Operand::Str("fairy.qoi"), Operand::Imm(8) }) );
+    REQUIRE( assembler.AddRamData("$counter", 32, 1) );
+    REQUIRE( assembler.AddLabel(".mediaEntry0001") );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$fairy") }) );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R1), Operand::Lbl("$counter") }) );
+    REQUIRE( assembler.AddInstruction(OP_HALT) );
+    assembler.SetRecorder(nullptr);
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(expected, result) == true );
+    REQUIRE( statements.size() == 6 );
+
+    assembler.Clear();
+    REQUIRE( assembler.Replay(statements) );
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+    REQUIRE( program == expected );
+}
+
+TEST_CASE( "Statements are only recorded" ) {
+
+    using Chip32::Operand;
+    std::vector<uint8_t> program;
+    std::vector<uint8_t> expected;
+    std::vector<Chip32::Statement> statements;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    REQUIRE( assembler.AddRomData("$fairy", 8, { Operand::Str("fairy.qoi"), Operand::Imm(8) }) );
+    REQUIRE( assembler.AddLabel(".mediaEntry0001") );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$fairy") }) );
+    REQUIRE( assembler.AddInstruction(OP_HALT) );
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(expected, result) == true );
+
+    // Nothing is encoded nor checked, the errors are found when replayed
+    assembler.Clear();
+    assembler.SetRecorder(&statements, true);
+    REQUIRE( assembler.AddRomData("$fairy", 8, { Operand::Str("fairy.qoi"), Operand::Imm(8) }) );
+    REQUIRE( assembler.AddLabel(".mediaEntry0001") );
+    REQUIRE( assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$fairy") }) );
+    REQUIRE( assembler.AddInstruction(OP_HALT) );
+    REQUIRE( assembler.AddInstruction(OP_JUMP, { Operand::Reg(R0) }) );
+    assembler.SetRecorder(nullptr);
+    REQUIRE( assembler.Begin() == assembler.End() );
+    REQUIRE( statements.size() == 5 );
+
+    REQUIRE( assembler.Replay(statements) == false );
+    statements.pop_back();
+    assembler.Clear();
+    REQUIRE( assembler.Replay(statements) );
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+    REQUIRE( program == expected );
+}
+
+TEST_CASE( "Assembly text is recorded" ) {
+
+    std::vector<uint8_t> program;
+    std::vector<uint8_t> expected;
+    std::vector<Chip32::Statement> statements;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+
+    assembler.SetRecorder(&statements);
+    REQUIRE( assembler.Append(test1) );
+    assembler.SetRecorder(nullptr);
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(expected, result) == true );
+    // 4 data, 2 labels and 13 instructions
+    REQUIRE( statements.size() == 19 );
+
+    assembler.Clear();
+    REQUIRE( assembler.Replay(statements) );
+    REQUIRE( assembler.Link() );
+    REQUIRE( assembler.BuildBinary(program, result) == true );
+    REQUIRE( program == expected );
+}
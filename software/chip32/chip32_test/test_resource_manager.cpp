@@ -0,0 +1,103 @@
+/*
+The MIT License
+
+Copyright (c) 2022 Anthony Rabine
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <vector>
+#include "catch.hpp"
+#include "resource_manager.h"
+
+/*
+Purpose: resources of a project, indexed by type and by file name
+*/
+
+static std::shared_ptr<Resource> MakeResource(const std::string &file, Resource::Type type)
+{
+    auto res = std::make_shared<Resource>();
+    res->file = file;
+    res->type = type;
+    return res;
+}
+
+static std::vector<std::string> Files(const ResourceManager::Range &range)
+{
+    std::vector<std::string> files;
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        files.push_back((*it)->file);
+    }
+    return files;
+}
+
+TEST_CASE( "Resource added with the same file name replaces the previous one" ) {
+
+    ResourceManager manager;
+    manager.Add(MakeResource("fairy.png", Resource::TYPE_IMAGE));
+    manager.Add(MakeResource("castle.png", Resource::TYPE_IMAGE));
+
+    // Same place in the insertion order, the type index follows the new type
+    auto replaced = MakeResource("fairy.png", Resource::TYPE_OTHER);
+    manager.Add(replaced);
+
+    REQUIRE( manager.Count() == 2 );
+    REQUIRE( manager.Find("fairy.png") == replaced );
+    REQUIRE( Files(manager.Items()) == std::vector<std::string>{ "fairy.png", "castle.png" } );
+    REQUIRE( Files(manager.Images()) == std::vector<std::string>{ "castle.png" } );
+    REQUIRE( Files(manager.Items(Resource::TYPE_OTHER)) == std::vector<std::string>{ "fairy.png" } );
+}
+
+TEST_CASE( "Resource deleted from a type range" ) {
+
+    ResourceManager manager;
+    manager.Add(MakeResource("fairy.png", Resource::TYPE_IMAGE));
+    manager.Add(MakeResource("forest.mp3", Resource::TYPE_SOUND));
+    manager.Add(MakeResource("castle.png", Resource::TYPE_IMAGE));
+    manager.Add(MakeResource("river.mp3", Resource::TYPE_SOUND));
+
+    // First sound: position 1 of the store
+    auto sounds = manager.Sounds();
+    REQUIRE( sounds.first.Index() == 1 );
+    manager.Delete(sounds.first);
+
+    // The indexes are rebuilt, the iterators give the new positions
+    REQUIRE( manager.Count() == 3 );
+    REQUIRE( manager.Find("forest.mp3") == nullptr );
+    REQUIRE( Files(manager.Items()) == std::vector<std::string>{ "fairy.png", "castle.png", "river.mp3" } );
+    REQUIRE( Files(manager.Images()) == std::vector<std::string>{ "fairy.png", "castle.png" } );
+    REQUIRE( Files(manager.Sounds()) == std::vector<std::string>{ "river.mp3" } );
+    REQUIRE( manager.Find("river.mp3")->type == Resource::TYPE_SOUND );
+
+    auto images = manager.Images();
+    auto it = images.first;
+    REQUIRE( it.Index() == 0 );
+    ++it;
+    REQUIRE( it.Index() == 1 );
+    REQUIRE( manager.Sounds().first.Index() == 2 );
+
+    // Deleted by the position in the store, the file name index follows
+    manager.Delete(it);
+    REQUIRE( Files(manager.Items()) == std::vector<std::string>{ "fairy.png", "river.mp3" } );
+    REQUIRE( manager.Find("castle.png") == nullptr );
+    REQUIRE( manager.Find("river.mp3") != nullptr );
+    REQUIRE( manager.Sounds().first.Index() == 1 );
+}
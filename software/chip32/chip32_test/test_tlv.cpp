@@ -0,0 +1,213 @@
+/*
+The MIT License
+
+Copyright (c) 2022 Anthony Rabine
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "catch.hpp"
+#include "story_index.h"
+
+/*
+Purpose: TLV codec and story index shared by the firmware and the story editor
+*/
+
+struct MemoryFile
+{
+    std::vector<uint8_t> data;
+    uint32_t pos{0};
+    uint32_t chunk{0}; //!< bytes returned by each read, like a file read by sectors
+};
+
+static uint32_t ReadMemoryFile(void *ctx, uint8_t *destination, uint32_t size)
+{
+    MemoryFile *f = static_cast<MemoryFile *>(ctx);
+    uint32_t count = std::min({ size, f->chunk, static_cast<uint32_t>(f->data.size()) - f->pos });
+    std::copy(f->data.begin() + f->pos, f->data.begin() + f->pos + count, destination);
+    f->pos += count;
+    return count;
+}
+
+static std::string Value(const tlv_item_t &item)
+{
+    return std::string(reinterpret_cast<const char *>(item.value), item.length);
+}
+
+TEST_CASE( "TLV writer overflow" ) {
+
+    uint8_t buffer[12];
+    tlv_writer_t w;
+    tlv_writer_init(&w, buffer, sizeof(buffer));
+
+    REQUIRE( tlv_add_string(&w, "hello", 5) );
+    REQUIRE( w.pos == 8 );
+    // 7 bytes do not fit, nothing is written after it even if it fits
+    REQUIRE( tlv_add_integer(&w, 42) == false );
+    REQUIRE( w.overflow );
+    REQUIRE( tlv_add_array(&w, 2) == false );
+    REQUIRE( w.pos == 8 );
+}
+
+TEST_CASE( "TLV reader truncation" ) {
+
+    uint8_t buffer[64];
+    tlv_writer_t w;
+    tlv_writer_init(&w, buffer, sizeof(buffer));
+    tlv_add_object(&w, 2);
+    tlv_add_string(&w, "hello", 5);
+    tlv_add_integer(&w, 1234);
+    REQUIRE( w.pos == 18 );
+
+    tlv_reader_t r;
+    tlv_item_t item;
+    tlv_reader_init(&r, buffer, w.pos);
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( item.type == TLV_OBJECT_TYPE );
+    REQUIRE( item.length == 2 );
+    REQUIRE( item.value == nullptr );
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( Value(item) == "hello" );
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( tlv_item_integer(&item) == 1234 );
+    REQUIRE( tlv_read(&r, &item) == false );
+
+    // String value cut by the end of the buffer
+    tlv_reader_init(&r, buffer, 9);
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( tlv_read(&r, &item) == false );
+    REQUIRE( r.pos == 3 );
+
+    // Header cut by the end of the buffer
+    tlv_reader_init(&r, buffer, 12);
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( tlv_read(&r, &item) );
+    REQUIRE( tlv_read(&r, &item) == false );
+}
+
+TEST_CASE( "TLV stream window refill" ) {
+
+    // Records of 3 + 3 + 10 + 7 bytes in a 24 bytes window: most records are across the end of the window
+    MemoryFile file;
+    file.data.resize(1024);
+    tlv_writer_t w;
+    tlv_writer_init(&w, file.data.data(), file.data.size());
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        tlv_add_array(&w, 1);
+        tlv_add_object(&w, 2);
+        std::string name = "story-" + std::to_string(100 + i);
+        tlv_add_string(&w, name.c_str(), name.size());
+        tlv_add_integer(&w, i);
+    }
+    REQUIRE( w.overflow == false );
+    file.data.resize(w.pos);
+    file.chunk = 5;
+
+    uint8_t window[24];
+    tlv_stream_t s;
+    tlv_item_t item;
+    tlv_stream_init(&s, ReadMemoryFile, &file, window, sizeof(window));
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        REQUIRE( tlv_stream_read(&s, &item) );
+        REQUIRE( item.type == TLV_ARRAY_TYPE );
+        REQUIRE( tlv_stream_read(&s, &item) );
+        REQUIRE( item.type == TLV_OBJECT_TYPE );
+        REQUIRE( tlv_stream_read(&s, &item) );
+        REQUIRE( Value(item) == "story-" + std::to_string(100 + i) );
+        REQUIRE( tlv_stream_read(&s, &item) );
+        REQUIRE( tlv_item_integer(&item) == i );
+    }
+    REQUIRE( tlv_stream_read(&s, &item) == false );
+
+    // A value bigger than the window cannot be read
+    std::string big(30, 'x');
+    file.data.resize(64);
+    tlv_writer_init(&w, file.data.data(), file.data.size());
+    tlv_add_string(&w, big.c_str(), big.size());
+    file.pos = 0;
+    tlv_stream_init(&s, ReadMemoryFile, &file, window, sizeof(window));
+    REQUIRE( tlv_stream_read(&s, &item) == false );
+
+    // Truncated file
+    file.data.resize(3 + 10);
+    file.pos = 0;
+    tlv_stream_init(&s, ReadMemoryFile, &file, window, sizeof(window));
+    REQUIRE( tlv_stream_read(&s, &item) == false );
+}
+
+TEST_CASE( "Story index header version" ) {
+
+    uint8_t header[STORY_INDEX_HEADER_SIZE];
+    uint16_t stories = 0;
+    uint32_t table = 0;
+
+    REQUIRE( story_index_header_put(header, 42) == STORY_INDEX_HEADER_SIZE );
+    REQUIRE( story_index_header_get(header, &stories, &table) );
+    REQUIRE( stories == 42 );
+    REQUIRE( table == STORY_INDEX_HEADER_SIZE );
+
+    // Index written by another version of the editor
+    tlv_u16_put(header + 4, STORY_INDEX_VERSION - 1);
+    REQUIRE( story_index_header_get(header, &stories, &table) == false );
+    tlv_u16_put(header + 4, STORY_INDEX_VERSION + 1);
+    REQUIRE( story_index_header_get(header, &stories, &table) == false );
+
+    // Version 1 index: a TLV stream, no header
+    header[0] = TLV_ARRAY_TYPE;
+    tlv_u16_put(header + 4, STORY_INDEX_VERSION);
+    REQUIRE( story_index_header_get(header, &stories, &table) == false );
+}
+
+TEST_CASE( "Story index records" ) {
+
+    // 254 ASCII characters then a 2 bytes character: the cut at 255 bytes is inside it
+    std::string name = std::string(254, 'a') + "\xC3\xA9";
+    std::string description(300, 'd');
+    const char *fields[STORY_INDEX_FIELD_COUNT] = { "0b4f6f1c-2b1a-4d5e-9c1e-3f1e2d3c4b5a", "title.qoi", "title.wav",
+                                                    name.c_str(), description.c_str() };
+
+    uint8_t buffer[STORY_INDEX_RECORD_MAX];
+    uint16_t size = story_index_record_put(buffer, 7, fields);
+
+    story_index_record_t record;
+    REQUIRE( story_index_record_get(buffer, size, &record) );
+    REQUIRE( record.version == 7 );
+    REQUIRE( std::string(record.fields[STORY_INDEX_FIELD_TITLE_IMAGE], record.lengths[STORY_INDEX_FIELD_TITLE_IMAGE]) == "title.qoi" );
+    REQUIRE( record.lengths[STORY_INDEX_FIELD_NAME] == 254 );
+    REQUIRE( record.lengths[STORY_INDEX_FIELD_DESCRIPTION] == STORY_INDEX_STRING_MAX );
+
+    // Only the beginning of the record is read: the fields after it are missing
+    uint32_t partial = TLV_HEADER_SIZE + 3 * TLV_HEADER_SIZE + 36 + 9 + 9 + 10;
+    REQUIRE( story_index_record_get(buffer, partial, &record) );
+    REQUIRE( record.lengths[STORY_INDEX_FIELD_UUID] == 36 );
+    REQUIRE( record.lengths[STORY_INDEX_FIELD_TITLE_SOUND] == 9 );
+    REQUIRE( record.fields[STORY_INDEX_FIELD_NAME] == nullptr );
+    REQUIRE( record.fields[STORY_INDEX_FIELD_DESCRIPTION] == nullptr );
+    REQUIRE( record.version == 0 );
+
+    // Not a record
+    buffer[0] = TLV_STRING_TYPE;
+    REQUIRE( story_index_record_get(buffer, size, &record) == false );
+}
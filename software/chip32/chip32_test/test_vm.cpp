@@ -25,7 +25,7 @@ THE SOFTWARE.
 #include <iostream>
 #include "catch.hpp"
 #include "chip32_assembler.h"
-#include "chip32.h"
+#include "chip32_vm.h"
 
 /*
 Purpose: test all opcodes
@@ -48,26 +48,26 @@ public:
         result.Print();
 
         // ---------  EXECUTE BINARY  ---------
-        virtual_mem_t rom = {
-            .mem = program.data(),
-            .size = 8*1024,
-            .addr = 18 * 1024
-        };
-        virtual_mem_t ram = {
-            .mem = data,
-            .size = sizeof(data),
-            .addr = 56*1024
-        };
-
-        chip32_initialize(&rom, &ram, 256);
-        chip32_result_t runResult = chip32_run(program.size(), 1000);
+        ctx.rom.mem = program.data();
+        ctx.rom.size = program.size();
+        ctx.rom.addr = 18 * 1024;
+        ctx.ram.mem = data;
+        ctx.ram.size = sizeof(data);
+        ctx.ram.addr = 56 * 1024;
+        ctx.stack_size = 256;
+        ctx.max_instr = 1000;
+        ctx.syscall = nullptr;
+
+        chip32_initialize(&ctx);
+        chip32_result_t runResult = chip32_run(&ctx);
         REQUIRE( runResult == VM_FINISHED );
     }
 
     uint8_t data[8*1024];
     std::vector<uint8_t> program;
-    Chip32Assembler assembler;
-    AssemblyResult result;
+    Chip32::Assembler assembler;
+    Chip32::Result result;
+    chip32_ctx_t ctx;
 };
 
 
@@ -80,7 +80,7 @@ TEST_CASE_METHOD(VmTestContext, "MUL", "[vm]") {
     )";
     Execute(test1);
 
-    uint32_t result = chip32_get_register(R0);
+    uint32_t result = ctx.registers[R0];
     REQUIRE (result == 37 * 0x695);
 }
 
@@ -93,6 +93,25 @@ TEST_CASE_METHOD(VmTestContext, "DIV", "[vm]") {
     )";
     Execute(test1);
 
-    uint32_t result = chip32_get_register(R0);
+    uint32_t result = ctx.registers[R0];
     REQUIRE (result == (int)(37/8));
 }
+
+TEST_CASE_METHOD(VmTestContext, "Compact LCONS and short jumps", "[vm]") {
+    static const std::string test1 = R"(
+        lcons r0, 0xA2
+        lcons r1, 0xBEEF
+        lcons r2, 0xCAFEBABE
+        jump .forward
+        lcons r0, 0
+.backward:
+        halt
+.forward:
+        jump .backward
+    )";
+    Execute(test1);
+
+    REQUIRE (ctx.registers[R0] == 0xA2);
+    REQUIRE (ctx.registers[R1] == 0xBEEF);
+    REQUIRE (ctx.registers[R2] == 0xCAFEBABE);
+}
@@ -101,7 +101,11 @@ chip32_result_t chip32_run(chip32_ctx_t *ctx)
     chip32_result_t result = VM_OK;
     while ((ctx->max_instr == 0) || (ctx->instrCount < ctx->max_instr))
     {
-        chip32_step(ctx);
+        result = chip32_step(ctx);
+        if (result != VM_OK)
+        {
+            break;
+        }
     }
     return result;
 }
@@ -148,6 +152,20 @@ chip32_result_t chip32_step(chip32_ctx_t *ctx)
         ctx->registers[reg] = _NEXT_INT(ctx);
         break;
     }
+    case OP_LCONS8:
+    {
+        const uint8_t reg = _NEXT_BYTE;
+        _CHECK_REGISTER_VALID(reg)
+        ctx->registers[reg] = _NEXT_BYTE;
+        break;
+    }
+    case OP_LCONS16:
+    {
+        const uint8_t reg = _NEXT_BYTE;
+        _CHECK_REGISTER_VALID(reg)
+        ctx->registers[reg] = _NEXT_SHORT(ctx);
+        break;
+    }
     case OP_MOV:
     {
         const uint8_t reg1 = _NEXT_BYTE;
@@ -331,6 +349,13 @@ chip32_result_t chip32_step(chip32_ctx_t *ctx)
         ctx->registers[PC] = _NEXT_SHORT(ctx) - 1;
         break;
     }
+    case OP_JUMPS:
+    {
+        // offset is relative to the next instruction, PC is on the offset byte
+        const int8_t offset = (int8_t)_NEXT_BYTE;
+        ctx->registers[PC] += offset;
+        break;
+    }
     case OP_JUMPR:
     {
         const uint8_t reg = _NEXT_BYTE;
@@ -80,6 +80,11 @@ typedef enum
     OP_SKIPZ = 24,  ///<  skip next instruction if zero, e.g.: skipz r0
     OP_SKIPNZ = 25, ///<  skip next instruction if not zero, e.g.: skipnz r2
 
+    // compact encodings, automatically selected by the assembler from lcons/jump:
+    OP_LCONS8 = 26,  ///< store an 8-bit immediate value in a register (zero-extended), e.g.: lcons r0, 0xA2
+    OP_LCONS16 = 27, ///< store a 16-bit immediate value or a ROM address in a register, e.g.: lcons r0, .label
+    OP_JUMPS = 28,   ///< short jump, signed 8-bit offset relative to the next instruction, e.g.: jump .near_label
+
     INSTRUCTION_COUNT
 } chip32_instruction_t;
 
@@ -155,7 +160,8 @@ typedef struct {
 { OP_STORE, 3, 4 }, { OP_LOAD, 3, 4 }, { OP_ADD, 2, 2 }, { OP_SUB, 2, 2 }, { OP_MUL, 2, 2 }, \
 { OP_DIV, 2, 2 }, { OP_SHL, 2, 2 }, { OP_SHR, 2, 2 }, { OP_ISHR, 2, 2 }, { OP_AND, 2, 2 }, \
 { OP_OR, 2, 2 }, { OP_XOR, 2, 2 }, { OP_NOT, 1, 1 }, { OP_CALL, 1, 1 }, { OP_RET, 0, 0 }, \
-{ OP_JUMP, 1, 2 }, { OP_JUMPR, 1, 1 }, { OP_SKIPZ, 1, 1 }, { OP_SKIPNZ, 1, 1 } }
+{ OP_JUMP, 1, 2 }, { OP_JUMPR, 1, 1 }, { OP_SKIPZ, 1, 1 }, { OP_SKIPNZ, 1, 1 }, \
+{ OP_LCONS8, 2, 2 }, { OP_LCONS16, 2, 3 }, { OP_JUMPS, 1, 1 } }
 
 /**
   Whole memory is 64KB
@@ -0,0 +1,154 @@
+#ifndef STORY_INDEX_H
+#define STORY_INDEX_H
+
+// Story index of the device (index.ost, at the root of the library), written by the
+// story editor and read by the firmware. All the integers are little endian.
+//
+//   header   "OSTI", u16 format version, u16 number of stories, u32 table offset, u32 reserved
+//   table    one entry per story: u32 record offset, u16 record size, u16 reserved
+//   record   TLV object (see tlv.h): the strings in the story_index_field_t order,
+//            then the story version (integer)
+//
+// Story N is one read of its table entry and one read of its record, whatever the
+// number of stories.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "tlv.h"
+
+#define STORY_INDEX_MAGIC           "OSTI"
+#define STORY_INDEX_VERSION         3
+#define STORY_INDEX_HEADER_SIZE     16
+#define STORY_INDEX_ENTRY_SIZE      8
+#define STORY_INDEX_MAX_STORIES     0xFFFF
+#define STORY_INDEX_STRING_MAX      255 // Longer strings are truncated, on a UTF-8 character boundary
+
+typedef enum
+{
+    STORY_INDEX_FIELD_UUID,
+    STORY_INDEX_FIELD_TITLE_IMAGE,
+    STORY_INDEX_FIELD_TITLE_SOUND,
+    STORY_INDEX_FIELD_NAME,
+    STORY_INDEX_FIELD_DESCRIPTION,
+    STORY_INDEX_FIELD_COUNT
+} story_index_field_t;
+
+#define STORY_INDEX_RECORD_MAX      (TLV_HEADER_SIZE + STORY_INDEX_FIELD_COUNT * (TLV_HEADER_SIZE + STORY_INDEX_STRING_MAX) + TLV_HEADER_SIZE + 4)
+
+typedef struct
+{
+    uint32_t version;
+    const char *fields[STORY_INDEX_FIELD_COUNT]; // Not zero terminated, NULL if not in the buffer
+    uint16_t lengths[STORY_INDEX_FIELD_COUNT];
+} story_index_record_t;
+
+// Header, the table follows it. Returns the size written.
+static inline uint32_t story_index_header_put(uint8_t *buff, uint16_t stories)
+{
+    memcpy(buff, STORY_INDEX_MAGIC, 4);
+    tlv_u16_put(buff + 4, STORY_INDEX_VERSION);
+    tlv_u16_put(buff + 6, stories);
+    tlv_u32_put(buff + 8, STORY_INDEX_HEADER_SIZE);
+    tlv_u32_put(buff + 12, 0);
+    return STORY_INDEX_HEADER_SIZE;
+}
+
+// False if this is not an index of this version (a version 1 index is a TLV stream)
+static inline bool story_index_header_get(const uint8_t *buff, uint16_t *stories, uint32_t *table_offset)
+{
+    if ((memcmp(buff, STORY_INDEX_MAGIC, 4) != 0) || (tlv_u16_get(buff + 4) != STORY_INDEX_VERSION))
+    {
+        return false;
+    }
+    *stories = tlv_u16_get(buff + 6);
+    *table_offset = tlv_u32_get(buff + 8);
+    return true;
+}
+
+static inline uint32_t story_index_entry_position(uint32_t table_offset, uint16_t story)
+{
+    return table_offset + (uint32_t)story * STORY_INDEX_ENTRY_SIZE;
+}
+
+static inline void story_index_entry_put(uint8_t *buff, uint32_t offset, uint16_t size)
+{
+    tlv_u32_put(buff, offset);
+    tlv_u16_put(buff + 4, size);
+    tlv_u16_put(buff + 6, 0);
+}
+
+static inline void story_index_entry_get(const uint8_t *buff, uint32_t *offset, uint16_t *size)
+{
+    *offset = tlv_u32_get(buff);
+    *size = tlv_u16_get(buff + 4);
+}
+
+// buff: at least STORY_INDEX_RECORD_MAX bytes, fields: STORY_INDEX_FIELD_COUNT strings.
+// Returns the size of the record.
+static inline uint16_t story_index_record_put(uint8_t *buff, uint32_t version, const char *const *fields)
+{
+    tlv_writer_t w;
+    tlv_writer_init(&w, buff, STORY_INDEX_RECORD_MAX);
+    tlv_add_object(&w, STORY_INDEX_FIELD_COUNT + 1);
+    for (int i = 0; i < STORY_INDEX_FIELD_COUNT; i++)
+    {
+        size_t length = strlen(fields[i]);
+        if (length > STORY_INDEX_STRING_MAX)
+        {
+            // Cut before a UTF-8 character, not in the middle of it (continuation bytes: 10xxxxxx)
+            length = STORY_INDEX_STRING_MAX;
+            while ((length > 0) && (((uint8_t)fields[i][length] & 0xC0U) == 0x80U))
+            {
+                length--;
+            }
+        }
+        tlv_add_string(&w, fields[i], (uint16_t)length);
+    }
+    tlv_add_integer(&w, version);
+    return (uint16_t)w.pos;
+}
+
+// Decoded in place. The record can be partially read (size smaller than the record
+// size): the fields after the buffer are NULL. Returns false if this is not a record.
+static inline bool story_index_record_get(const uint8_t *buff, uint32_t size, story_index_record_t *record)
+{
+    tlv_reader_t r;
+    tlv_item_t item;
+
+    record->version = 0;
+    for (int i = 0; i < STORY_INDEX_FIELD_COUNT; i++)
+    {
+        record->fields[i] = NULL;
+        record->lengths[i] = 0;
+    }
+
+    tlv_reader_init(&r, buff, size);
+    if (!tlv_read(&r, &item) || (item.type != TLV_OBJECT_TYPE))
+    {
+        return false;
+    }
+
+    for (int i = 0; (i < STORY_INDEX_FIELD_COUNT) && tlv_read(&r, &item) && (item.type == TLV_STRING_TYPE); i++)
+    {
+        record->fields[i] = (const char *)item.value;
+        record->lengths[i] = item.length;
+    }
+    if (tlv_read(&r, &item) && (item.type == TLV_INTEGER_TYPE))
+    {
+        record->version = tlv_item_integer(&item);
+    }
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STORY_INDEX_H
@@ -1,70 +1,275 @@
 #ifndef TLV_H
 #define TLV_H
 
+// TLV (Type Length Value) codec, shared by the firmware (C) and the tools (C++).
+//
+//   type    u8, one of the TLV_xxx_TYPE values
+//   length  u16 little endian: size of the value, or number of items of an array
+//           or an object (the items follow, there is no value)
+//   value   string: the characters, without zero
+//           integer: u32 little endian, real: IEEE 754 float, little endian
+//
+// The writer encodes into a buffer given by the caller, written at once by the caller.
+// The reader decodes a buffer in memory: the values are views in this buffer.
+// The stream reader decodes a file read by blocks in a window buffer (FatFs): the
+// values are views in the window, valid until the next item is read.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define TLV_ARRAY_TYPE      0xAB
+#define TLV_OBJECT_TYPE     0xE7
+#define TLV_STRING_TYPE     0x3D
+#define TLV_INTEGER_TYPE    0x77
+#define TLV_REAL_TYPE       0xB8
+
+#define TLV_HEADER_SIZE     3
+#define TLV_STRING_MAX      0xFFFF
 
-#define TLV_ARRAY_TYPE  0xAB
-#define TLV_OBJECT_TYPE  0xE7
-#define TLV_STRING_TYPE  0x3D
-#define TLV_INTEGER     0x77
-#define TLV_REAL        0xB8
+// -----------------------------------------------------------------------------
+// Little endian integers
+// -----------------------------------------------------------------------------
+static inline void tlv_u16_put(uint8_t *buff, uint16_t data)
+{
+    buff[0] = data & 0xFFU;
+    buff[1] = (data >> 8U) & 0xFFU;
+}
+
+static inline uint16_t tlv_u16_get(const uint8_t *buff)
+{
+    return (uint16_t)(buff[0] | ((uint16_t)buff[1] << 8U));
+}
 
-#include <iostream>
-#include <fstream>
+static inline void tlv_u32_put(uint8_t *buff, uint32_t data)
+{
+    tlv_u16_put(buff, data & 0xFFFFU);
+    tlv_u16_put(buff + 2, (data >> 16U) & 0xFFFFU);
+}
 
-class Tlv
+static inline uint32_t tlv_u32_get(const uint8_t *buff)
 {
-public:
-    explicit Tlv(const std::string &filename)
+    return tlv_u16_get(buff) | ((uint32_t)tlv_u16_get(buff + 2) << 16U);
+}
+
+// -----------------------------------------------------------------------------
+// Writer
+// -----------------------------------------------------------------------------
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t pos;       // Size of the encoded data
+    bool overflow;      // Set when an item did not fit, nothing is written after it
+} tlv_writer_t;
+
+static inline void tlv_writer_init(tlv_writer_t *w, uint8_t *buffer, uint32_t size)
+{
+    w->buffer = buffer;
+    w->size = size;
+    w->pos = 0;
+    w->overflow = false;
+}
+
+static inline bool tlv_add(tlv_writer_t *w, uint8_t type, uint16_t length, const void *value, uint16_t value_size)
+{
+    if (w->overflow || (w->pos + TLV_HEADER_SIZE + value_size > w->size))
     {
-        m_file = std::ofstream(filename, std::ios::out | std::ios::binary);
+        w->overflow = true;
+        return false;
     }
-
-    ~Tlv() {
-        m_file.close();
+    w->buffer[w->pos] = type;
+    tlv_u16_put(&w->buffer[w->pos + 1], length);
+    if (value_size > 0)
+    {
+        memcpy(&w->buffer[w->pos + TLV_HEADER_SIZE], value, value_size);
     }
+    w->pos += TLV_HEADER_SIZE + value_size;
+    return true;
+}
+
+static inline bool tlv_add_array(tlv_writer_t *w, uint16_t items)
+{
+    return tlv_add(w, TLV_ARRAY_TYPE, items, NULL, 0);
+}
+
+static inline bool tlv_add_object(tlv_writer_t *w, uint16_t entries)
+{
+    return tlv_add(w, TLV_OBJECT_TYPE, entries, NULL, 0);
+}
+
+static inline bool tlv_add_string(tlv_writer_t *w, const char *s, uint16_t length)
+{
+    return tlv_add(w, TLV_STRING_TYPE, length, s, length);
+}
+
+static inline bool tlv_add_integer(tlv_writer_t *w, uint32_t value)
+{
+    uint8_t bytes[4];
+    tlv_u32_put(bytes, value);
+    return tlv_add(w, TLV_INTEGER_TYPE, 4, bytes, 4);
+}
+
+static inline bool tlv_add_real(tlv_writer_t *w, float value)
+{
+    uint32_t bits;
+    uint8_t bytes[4];
+    memcpy(&bits, &value, 4);
+    tlv_u32_put(bytes, bits);
+    return tlv_add(w, TLV_REAL_TYPE, 4, bytes, 4);
+}
+
+// -----------------------------------------------------------------------------
+// Readers
+// -----------------------------------------------------------------------------
+typedef struct
+{
+    uint8_t type;
+    uint16_t length;        // Value size, or number of items of an array or an object
+    const uint8_t *value;   // NULL for an array or an object
+} tlv_item_t;
+
+static inline bool tlv_has_value(uint8_t type)
+{
+    return (type != TLV_ARRAY_TYPE) && (type != TLV_OBJECT_TYPE);
+}
 
-    void add_array(uint16_t size)
+static inline uint32_t tlv_item_integer(const tlv_item_t *item)
+{
+    return (item->length == 4) ? tlv_u32_get(item->value) : 0;
+}
+
+static inline float tlv_item_real(const tlv_item_t *item)
+{
+    float value = 0.0f;
+    if (item->length == 4)
     {
-        m_file.write(reinterpret_cast<const char*>(&m_objectType), sizeof(m_objectType));
-        m_file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        uint32_t bits = tlv_u32_get(item->value);
+        memcpy(&value, &bits, 4);
     }
+    return value;
+}
 
-    void add_string(const char *s, uint16_t size)
-    {
-        m_file.write(reinterpret_cast<const char*>(&m_stringType), sizeof(m_stringType));
+typedef struct
+{
+    const uint8_t *buffer;
+    uint32_t size;
+    uint32_t pos;
+} tlv_reader_t;
 
-        m_file.write(s, size);
-    }
+static inline void tlv_reader_init(tlv_reader_t *r, const uint8_t *buffer, uint32_t size)
+{
+    r->buffer = buffer;
+    r->size = size;
+    r->pos = 0;
+}
 
-    void add_integer(uint32_t value)
+// False at the end of the buffer, or if the item is not complete in the buffer
+static inline bool tlv_read(tlv_reader_t *r, tlv_item_t *item)
+{
+    if (r->pos + TLV_HEADER_SIZE > r->size)
     {
-        static const uint16_t size = 4;
-        m_file.write(reinterpret_cast<const char*>(&m_integerType), sizeof(m_integerType));
-        m_file.write(reinterpret_cast<const char*>(&size), sizeof(size));
-        m_file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        return false;
     }
+    item->type = r->buffer[r->pos];
+    item->length = tlv_u16_get(&r->buffer[r->pos + 1]);
+    item->value = NULL;
 
-    void add_string(const std::string &s)
+    uint32_t value_size = tlv_has_value(item->type) ? item->length : 0;
+    if (r->pos + TLV_HEADER_SIZE + value_size > r->size)
     {
-        add_string(s.c_str(), s.size());
+        return false;
     }
-
-    void add_object(uint16_t entries)
+    if (value_size > 0)
     {
-        m_file.write(reinterpret_cast<const char*>(&m_arrayType), sizeof(m_arrayType));
-        m_file.write(reinterpret_cast<const char*>(&entries), sizeof(entries));
+        item->value = &r->buffer[r->pos + TLV_HEADER_SIZE];
     }
+    r->pos += TLV_HEADER_SIZE + value_size;
+    return true;
+}
+
+// Reads up to size bytes in destination, returns the number of bytes read (0: end of file or error)
+typedef uint32_t (*tlv_read_cb_t)(void *ctx, uint8_t *destination, uint32_t size);
+
+typedef struct
+{
+    tlv_read_cb_t read;
+    void *ctx;
+    uint8_t *window;
+    uint32_t size;
+    uint32_t start;     // Next item in the window
+    uint32_t end;       // End of the data read in the window
+} tlv_stream_t;
 
-private:
-    std::ofstream m_file;
+static inline void tlv_stream_init(tlv_stream_t *s, tlv_read_cb_t read, void *ctx, uint8_t *window, uint32_t size)
+{
+    s->read = read;
+    s->ctx = ctx;
+    s->window = window;
+    s->size = size;
+    s->start = 0;
+    s->end = 0;
+}
+
+// At least needed bytes after start in the window, moved to its beginning if needed
+static inline bool tlv_stream_fill(tlv_stream_t *s, uint32_t needed)
+{
+    if (s->end - s->start >= needed)
+    {
+        return true;
+    }
+    if (needed > s->size)
+    {
+        return false; // Value bigger than the window
+    }
+    if (s->start + needed > s->size)
+    {
+        memmove(s->window, &s->window[s->start], s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+    }
+    while (s->end - s->start < needed)
+    {
+        uint32_t count = s->read(s->ctx, &s->window[s->end], s->size - s->end);
+        if (count == 0)
+        {
+            return false;
+        }
+        s->end += count;
+    }
+    return true;
+}
 
-    uint8_t m_arrayType = TLV_ARRAY_TYPE;
-    uint8_t m_objectType = TLV_OBJECT_TYPE;
-    uint8_t m_stringType = TLV_STRING_TYPE;
-    uint8_t m_integerType = TLV_INTEGER;
+// False at the end of the file, or if a value does not fit in the window
+static inline bool tlv_stream_read(tlv_stream_t *s, tlv_item_t *item)
+{
+    if (!tlv_stream_fill(s, TLV_HEADER_SIZE))
+    {
+        return false;
+    }
+    item->type = s->window[s->start];
+    item->length = tlv_u16_get(&s->window[s->start + 1]);
+    item->value = NULL;
 
-};
+    uint32_t value_size = tlv_has_value(item->type) ? item->length : 0;
+    if (!tlv_stream_fill(s, TLV_HEADER_SIZE + value_size))
+    {
+        return false;
+    }
+    if (value_size > 0)
+    {
+        item->value = &s->window[s->start + TLV_HEADER_SIZE];
+    }
+    s->start += TLV_HEADER_SIZE + value_size;
+    return true;
+}
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif // TLV_H
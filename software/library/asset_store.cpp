@@ -0,0 +1,238 @@
+#include "asset_store.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+
+#include "json.hpp"
+#include "sha256.h"
+
+static const int cStoreVersion = 1;
+
+void AssetStore::Initialize(const std::string &library_path)
+{
+    std::filesystem::path path = std::filesystem::path(library_path) / "assets_store";
+    if (path == m_path)
+    {
+        return;
+    }
+
+    m_path = path;
+    Load();
+}
+
+std::string AssetStore::Import(const std::filesystem::path &file)
+{
+    if (!IsInitialized())
+    {
+        return "";
+    }
+
+    std::string hash = Sha256::File(file);
+    if (hash.empty())
+    {
+        return "";
+    }
+
+    if (m_objects.count(hash) == 0)
+    {
+        std::error_code ec;
+        std::filesystem::path object = ObjectPath(hash);
+        std::filesystem::create_directories(object.parent_path(), ec);
+        std::filesystem::copy_file(file, object, std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec)
+        {
+            std::cout << "Cannot store " << file << ": " << ec.message() << std::endl;
+            return "";
+        }
+
+        Object obj;
+        obj.size = std::filesystem::file_size(object, ec);
+        m_objects.emplace(hash, obj);
+        Save();
+    }
+    return hash;
+}
+
+void AssetStore::SetReferences(const std::string &uuid, const std::set<std::string> &hashes)
+{
+    if (!IsInitialized())
+    {
+        return;
+    }
+
+    for (auto it = m_objects.begin(); it != m_objects.end();)
+    {
+        auto next = std::next(it);
+        auto &stories = it->second.stories;
+        auto ref = std::find(stories.begin(), stories.end(), uuid);
+        bool referenced = hashes.count(it->first) > 0;
+
+        if ((ref == stories.end()) && referenced)
+        {
+            stories.push_back(uuid);
+        }
+        else if ((ref != stories.end()) && !referenced)
+        {
+            stories.erase(ref);
+            if (stories.empty())
+            {
+                Remove(it);
+            }
+        }
+        it = next;
+    }
+    Save();
+}
+
+void AssetStore::Remove(std::map<std::string, Object>::iterator it)
+{
+    // The hard links of the projects keep their content
+    std::error_code ec;
+    std::filesystem::remove(ObjectPath(it->first), ec);
+    for (const auto &format : it->second.converted)
+    {
+        std::filesystem::remove(ConvertedPath(it->first, format), ec);
+    }
+    m_objects.erase(it);
+}
+
+int AssetStore::References(const std::string &hash) const
+{
+    auto it = m_objects.find(hash);
+    return (it != m_objects.end()) ? it->second.stories.size() : 0;
+}
+
+bool AssetStore::Link(const std::string &hash, const std::filesystem::path &destination) const
+{
+    return (m_objects.count(hash) > 0) && LinkOrCopy(ObjectPath(hash), destination);
+}
+
+bool AssetStore::LinkConverted(const std::string &hash, const std::string &format, const std::filesystem::path &destination) const
+{
+    auto it = m_objects.find(hash);
+    if ((it == m_objects.end()) ||
+        (std::find(it->second.converted.begin(), it->second.converted.end(), format) == it->second.converted.end()))
+    {
+        return false;
+    }
+    return LinkOrCopy(ConvertedPath(hash, format), destination);
+}
+
+void AssetStore::AddConverted(const std::string &hash, const std::string &format, const std::filesystem::path &file)
+{
+    auto it = m_objects.find(hash);
+    if (it == m_objects.end())
+    {
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(ConvertedPath(hash, format).parent_path(), ec);
+    if (LinkOrCopy(file, ConvertedPath(hash, format)) &&
+        (std::find(it->second.converted.begin(), it->second.converted.end(), format) == it->second.converted.end()))
+    {
+        it->second.converted.push_back(format);
+        Save();
+    }
+}
+
+bool AssetStore::LinkOrCopy(const std::filesystem::path &from, const std::filesystem::path &to)
+{
+    std::error_code ec;
+    if (std::filesystem::equivalent(from, to, ec))
+    {
+        return true;
+    }
+
+    std::filesystem::remove(to, ec);
+    std::filesystem::create_hard_link(from, to, ec);
+    if (ec)
+    {
+        ec.clear();
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+    }
+    return !ec;
+}
+
+std::filesystem::path AssetStore::ObjectPath(const std::string &hash) const
+{
+    // Sub-directories by the first two characters, to keep the directories small
+    return m_path / "objects" / hash.substr(0, 2) / hash;
+}
+
+std::filesystem::path AssetStore::ConvertedPath(const std::string &hash, const std::string &format) const
+{
+    return m_path / "converted" / hash.substr(0, 2) / (hash + "." + format);
+}
+
+void AssetStore::Load()
+{
+    m_objects.clear();
+
+    std::ifstream f(m_path / "refs.json");
+    if (!f.is_open())
+    {
+        return;
+    }
+
+    try
+    {
+        nlohmann::json j = nlohmann::json::parse(f);
+        if (j["version"].get<int>() != cStoreVersion)
+        {
+            return;
+        }
+
+        for (const auto &o : j["objects"].items())
+        {
+            Object obj;
+            obj.size = o.value()["size"].get<uint64_t>();
+            obj.stories = o.value()["stories"].get<std::vector<std::string>>();
+            obj.converted = o.value()["converted"].get<std::vector<std::string>>();
+            m_objects[o.key()] = obj;
+        }
+
+        // Imported by a project which was not saved
+        size_t count = m_objects.size();
+        for (auto it = m_objects.begin(); it != m_objects.end();)
+        {
+            auto next = std::next(it);
+            if (it->second.stories.empty())
+            {
+                Remove(it);
+            }
+            it = next;
+        }
+        if (m_objects.size() != count)
+        {
+            Save();
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "Asset store references ignored: " << e.what() << std::endl;
+        m_objects.clear();
+    }
+}
+
+void AssetStore::Save() const
+{
+    nlohmann::json objects = nlohmann::json::object();
+    for (const auto &o : m_objects)
+    {
+        objects[o.first] = { { "size", o.second.size },
+                             { "stories", o.second.stories },
+                             { "converted", o.second.converted } };
+    }
+
+    nlohmann::json j;
+    j["version"] = cStoreVersion;
+    j["objects"] = objects;
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_path, ec);
+    std::ofstream o(m_path / "refs.json");
+    o << j;
+}
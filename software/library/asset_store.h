@@ -0,0 +1,63 @@
+#ifndef ASSET_STORE_H
+#define ASSET_STORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdint>
+#include <filesystem>
+
+// Library level store of the asset files, addressed by the SHA-256 of their content.
+// A file used by several stories is stored once, the project assets directories
+// get a hard link to it (a copy if the file system does not support them).
+// The converted outputs are also stored once per content and target format.
+// The references of a story are the ones of its saved project file (SetReferences()):
+// the edits not saved do not change them. An object is deleted when the last story
+// referencing it is saved without it, or at the next start if it was never referenced.
+// The editor never writes a linked file in place (it is removed first), but an external
+// application saving a project asset in place changes the store object, thus the same
+// asset of every other story: this is the limit of the sharing option.
+class AssetStore
+{
+public:
+    // Does nothing if the store of this directory is already loaded
+    void Initialize(const std::string &library_path);
+    bool IsInitialized() const { return !m_path.empty(); }
+
+    // Adds the file content to the store, without reference,
+    // returns the content hash or an empty string on error
+    std::string Import(const std::filesystem::path &file);
+    // Hashes of the resources of the story, when its project is saved
+    void SetReferences(const std::string &uuid, const std::set<std::string> &hashes);
+    // Number of stories referencing the content
+    int References(const std::string &hash) const;
+
+    // Places the stored content at destination
+    bool Link(const std::string &hash, const std::filesystem::path &destination) const;
+
+    // Converted outputs, format is the target file extension (qoi, wav...)
+    bool LinkConverted(const std::string &hash, const std::string &format, const std::filesystem::path &destination) const;
+    void AddConverted(const std::string &hash, const std::string &format, const std::filesystem::path &file);
+
+    static bool LinkOrCopy(const std::filesystem::path &from, const std::filesystem::path &to);
+
+private:
+    struct Object {
+        uint64_t size{0};
+        std::vector<std::string> stories; // One entry per story
+        std::vector<std::string> converted; // Formats
+    };
+
+    std::filesystem::path m_path;
+    std::map<std::string, Object> m_objects; // key: content hash
+
+    std::filesystem::path ObjectPath(const std::string &hash) const;
+    std::filesystem::path ConvertedPath(const std::string &hash, const std::string &format) const;
+    void Remove(std::map<std::string, Object>::iterator it);
+
+    void Load();
+    void Save() const;
+};
+
+#endif // ASSET_STORE_H
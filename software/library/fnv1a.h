@@ -0,0 +1,28 @@
+#ifndef FNV1A_H
+#define FNV1A_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// FNV-1a, 64-bit: fast hash of the cache keys. Not for the content identity (see sha256.h).
+// A hash can be continued with more data by passing the previous result.
+static const uint64_t cFnv1aBasis = 0xcbf29ce484222325ULL;
+
+inline uint64_t Fnv1a(const void *data, size_t size, uint64_t hash = cFnv1aBasis)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline uint64_t Fnv1a(const std::string &data, uint64_t hash = cFnv1aBasis)
+{
+    return Fnv1a(data.data(), data.size(), hash);
+}
+
+#endif // FNV1A_H
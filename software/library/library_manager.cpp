@@ -1,61 +1,299 @@
 #include "library_manager.h"
-#include "tlv.h"
+#include "story_index.h"
 #include <filesystem>
+#include <fstream>
+#include <algorithm>
 
 #include "json.hpp"
 #include "story_project.h"
 #include "uuid.h"
+#include "thread_pool.hpp"
+
+// Story information of the library, see Scan()
+static const int cCacheVersion = 1;
 
 
 LibraryManager::LibraryManager() {}
 
 void LibraryManager::Initialize(const std::string &library_path)
 {
+    // Changes of the previous library not applied yet
+    m_watcher.Stop();
+    StoryUpdate previous;
+    while (m_updates.try_pop(previous)) {}
+
     m_library_path = library_path;
+    m_assetStore.Initialize(library_path);
+
+    // Started first, the changes made during the scan are reported after it
+    m_watcher.Start(library_path, [this, library_path](const std::set<std::string> &uuids, bool rescan) {
+        OnStoriesChanged(library_path, uuids, rescan);
+    });
     Scan();
 }
 
 void LibraryManager::Scan()
 {
     std::filesystem::path directoryPath(m_library_path);
-    if (std::filesystem::exists(directoryPath) && std::filesystem::is_directory(directoryPath))
+    if (!std::filesystem::exists(directoryPath) || !std::filesystem::is_directory(directoryPath))
     {
-        m_projectsList.clear();
-        for (const auto& entry : std::filesystem::directory_iterator(directoryPath))
+        return;
+    }
+
+    LoadCache();
+    m_projectsList.clear();
+
+    struct Story {
+        std::string uuid;
+        std::filesystem::path file;
+        CacheEntry info;
+        bool found{false};
+        bool cached{false};
+    };
+    std::vector<Story> stories;
+
+    // 1. Story directories and the size and date of their project file
+    for (const auto& entry : std::filesystem::directory_iterator(directoryPath))
+    {
+        std::string uuid = entry.path().filename().string();
+        if (entry.is_directory() && UUID::IsValid(uuid))
         {
-            if (std::filesystem::is_directory(entry.path()))
+            Story story;
+            story.uuid = uuid;
+            story.file = StoryProject::FindProjectFile(entry.path());
+
+            std::error_code ec;
+            story.info.size = std::filesystem::file_size(story.file, ec);
+            if (!ec)
+            {
+                story.info.mtime = std::filesystem::last_write_time(story.file, ec).time_since_epoch().count();
+            }
+            if (ec)
+            {
+                continue;
+            }
+
+            // Unchanged project files are not opened
+            auto it = m_cache.find(uuid);
+            if ((it != m_cache.end()) && (it->second.size == story.info.size) && (it->second.mtime == story.info.mtime))
+            {
+                story.info = it->second;
+                story.found = true;
+                story.cached = true;
+            }
+            stories.push_back(story);
+        }
+    }
+
+    // 2. The header of the other ones is read in parallel
+    size_t parsed = std::count_if(stories.begin(), stories.end(), [](const Story &s) { return !s.cached; });
+    if (parsed > 0)
+    {
+        thread_pool pool;
+        pool.parallelize_loop(size_t(0), stories.size(), [&stories](size_t start, size_t end) {
+            for (size_t i = start; i < end; i++)
             {
-                // Si c'est un sous-répertoire, récursivement scanner le contenu
-                std::string uuid = entry.path().filename();
-                if (UUID::IsValid(uuid))
+                Story &story = stories[i];
+                if (story.cached)
                 {
-                    std::cout << "Found story directory" << std::endl;
-                    // Look for a story.json file in this directory
-                    auto p = entry.path() / "project.json";
-                    if (std::filesystem::exists(p))
-                    {
-                        // okay, open it
-                        auto proj = std::make_shared<StoryProject>();
-                        try {
-                            std::ifstream f(p);
-                            nlohmann::json j = nlohmann::json::parse(f);
-
-                            if (proj->ParseStoryInformation(j))
-                            {
-                                // Valid project file, add it to the list
-                                proj->SetPaths(uuid, m_library_path);
-                                m_projectsList.push_back(proj);
-                            }
-                        }
-                        catch(std::exception &e)
-                        {
-                            std::cout << e.what() << std::endl;
-                        }
-                    }
+                    continue;
                 }
+
+                story.found = ReadEntry(story.file, story.info);
+            }
+        });
+    }
+
+    // 3. Valid projects, in the directory order
+    size_t previous = m_cache.size();
+    m_cache.clear();
+    for (const auto &story : stories)
+    {
+        if (story.found)
+        {
+            m_projectsList.push_back(MakeProject(story.uuid, story.info));
+            m_cache[story.uuid] = story.info;
+        }
+    }
+
+    if ((parsed > 0) || (m_cache.size() != previous))
+    {
+        SaveCache();
+    }
+}
+
+void LibraryManager::OnStoriesChanged(const std::string &library_path, const std::set<std::string> &uuids, bool rescan)
+{
+    // Watcher thread: only the project headers are read here, the list is updated by Update()
+    if (rescan)
+    {
+        StoryUpdate update;
+        update.rescan = true;
+        m_updates.push(std::move(update));
+        return;
+    }
+
+    for (const auto &uuid : uuids)
+    {
+        StoryUpdate update;
+        update.uuid = uuid;
+
+        std::filesystem::path file = StoryProject::FindProjectFile(std::filesystem::path(library_path) / uuid);
+        std::error_code ec;
+        update.info.size = std::filesystem::file_size(file, ec);
+        if (!ec)
+        {
+            update.info.mtime = std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+        }
+        if (!ec)
+        {
+            update.found = ReadEntry(file, update.info);
+            if (!update.found)
+            {
+                continue; // Being written, its next change is reported
+            }
+        }
+        m_updates.push(std::move(update));
+    }
+}
+
+bool LibraryManager::Update()
+{
+    bool changed = false;
+    bool rescan = false;
+    StoryUpdate update;
+    while (m_updates.try_pop(update))
+    {
+        if (update.rescan)
+        {
+            rescan = true;
+            continue;
+        }
+
+        auto it = std::find_if(m_projectsList.begin(), m_projectsList.end(),
+                               [&update](const std::shared_ptr<StoryProject> &p) { return p->GetUuid() == update.uuid; });
+        if (update.found)
+        {
+            if (it != m_projectsList.end())
+            {
+                // Same object, it can be the opened project
+                (*it)->SetName(update.info.name);
+                (*it)->SetTitleImage(update.info.titleImage);
+                (*it)->SetTitleSound(update.info.titleSound);
+                (*it)->SetVersion(update.info.version);
             }
+            else
+            {
+                m_projectsList.push_back(MakeProject(update.uuid, update.info));
+            }
+            m_cache[update.uuid] = update.info;
+            changed = true;
         }
+        else if (it != m_projectsList.end())
+        {
+            m_projectsList.erase(it);
+            m_cache.erase(update.uuid);
+            changed = true;
+        }
+    }
+
+    if (rescan)
+    {
+        Scan();
+        return true;
+    }
+    if (changed)
+    {
+        SaveCache();
     }
+    return changed;
+}
+
+std::shared_ptr<StoryProject> LibraryManager::MakeProject(const std::string &uuid, const CacheEntry &info) const
+{
+    auto proj = std::make_shared<StoryProject>();
+    proj->SetUuid(uuid);
+    proj->SetName(info.name);
+    proj->SetTitleImage(info.titleImage);
+    proj->SetTitleSound(info.titleSound);
+    proj->SetVersion(info.version);
+    proj->SetPaths(uuid, m_library_path);
+    return proj;
+}
+
+bool LibraryManager::ReadEntry(const std::filesystem::path &file, CacheEntry &info)
+{
+    StoryProject proj;
+    if (!proj.ReadStoryInformation(file))
+    {
+        std::cout << "Invalid project file: " << file << std::endl;
+        return false;
+    }
+
+    info.name = proj.GetName();
+    info.titleImage = proj.GetTitleImage();
+    info.titleSound = proj.GetTitleSound();
+    info.version = proj.GetVersion();
+    return true;
+}
+
+void LibraryManager::LoadCache()
+{
+    m_cache.clear();
+
+    std::ifstream f(std::filesystem::path(m_library_path) / "library_cache.json");
+    if (!f.is_open())
+    {
+        return;
+    }
+
+    try
+    {
+        nlohmann::json j = nlohmann::json::parse(f);
+        if (j["version"].get<int>() != cCacheVersion)
+        {
+            return;
+        }
+
+        for (const auto &s : j["stories"].items())
+        {
+            CacheEntry entry;
+            entry.name = s.value()["name"].get<std::string>();
+            entry.titleImage = s.value()["title_image"].get<std::string>();
+            entry.titleSound = s.value()["title_sound"].get<std::string>();
+            entry.version = s.value()["version"].get<int>();
+            entry.size = s.value()["size"].get<uint64_t>();
+            entry.mtime = s.value()["mtime"].get<int64_t>();
+            m_cache[s.key()] = entry;
+        }
+    }
+    catch (std::exception &e)
+    {
+        // A bad cache is only a slower scan
+        std::cout << "Library cache ignored: " << e.what() << std::endl;
+        m_cache.clear();
+    }
+}
+
+void LibraryManager::SaveCache()
+{
+    nlohmann::json stories = nlohmann::json::object();
+    for (const auto &c : m_cache)
+    {
+        stories[c.first] = { { "name", c.second.name },
+                             { "title_image", c.second.titleImage },
+                             { "title_sound", c.second.titleSound },
+                             { "version", c.second.version },
+                             { "size", c.second.size },
+                             { "mtime", c.second.mtime } };
+    }
+
+    nlohmann::json j;
+    j["version"] = cCacheVersion;
+    j["stories"] = stories;
+
+    std::ofstream o(std::filesystem::path(m_library_path) / "library_cache.json");
+    o << j;
 }
 
 std::shared_ptr<StoryProject> LibraryManager::NewProject()
@@ -86,34 +324,35 @@ std::shared_ptr<StoryProject> LibraryManager::GetStory(const std::string &uuid)
 
 void LibraryManager::Save()
 {
-    auto p = std::filesystem::path(m_library_path) / "index.ost";
-    Tlv tlv(p.string());
+    // Built in memory and written at once, the format is in story_index.h
+    uint16_t count = std::min<size_t>(m_projectsList.size(), STORY_INDEX_MAX_STORIES);
+    std::vector<uint8_t> index(STORY_INDEX_HEADER_SIZE + count * STORY_INDEX_ENTRY_SIZE);
+    story_index_header_put(index.data(), count);
 
-    tlv.add_object(1);
-    tlv.add_string(GetVersion());
-
-    tlv.add_array(m_projectsList.size());
-    for (auto &p : m_projectsList)
+    uint8_t record[STORY_INDEX_RECORD_MAX];
+    for (uint16_t i = 0; i < count; i++)
     {
-        tlv.add_object(6);
-        tlv.add_string(p->GetUuid());
-        tlv.add_string(p->GetTitleImage());
-        tlv.add_string(p->GetTitleSound());
-        tlv.add_string(p->GetName());
-        tlv.add_string(p->GetDescription());
-        tlv.add_integer(p->GetVersion());
-    }
-
-    /*
+        const auto &p = m_projectsList[i];
+        std::string fields[STORY_INDEX_FIELD_COUNT];
+        fields[STORY_INDEX_FIELD_UUID] = p->GetUuid();
+        fields[STORY_INDEX_FIELD_TITLE_IMAGE] = p->GetTitleImage();
+        fields[STORY_INDEX_FIELD_TITLE_SOUND] = p->GetTitleSound();
+        fields[STORY_INDEX_FIELD_NAME] = p->GetName();
+        fields[STORY_INDEX_FIELD_DESCRIPTION] = p->GetDescription();
 
+        const char *strings[STORY_INDEX_FIELD_COUNT];
+        for (int f = 0; f < STORY_INDEX_FIELD_COUNT; f++)
+        {
+            strings[f] = fields[f].c_str();
+        }
 
-    // Title image
-    std::string image =  RemoveFileExtension(m_titleImage) + ".qoi";
-    tlv.add_string(image.c_str(), image.size());
+        uint16_t size = story_index_record_put(record, p->GetVersion(), strings);
+        story_index_entry_put(&index[story_index_entry_position(STORY_INDEX_HEADER_SIZE, i)], index.size(), size);
+        index.insert(index.end(), record, record + size);
+    }
 
-    std::string sound =  RemoveFileExtension(m_titleSound) + ".wav";
-    tlv.add_string(sound.c_str(), sound.size()); // title sound
-*/
+    std::ofstream o(std::filesystem::path(m_library_path) / "index.ost", std::ios::out | std::ios::binary | std::ios::trunc);
+    o.write(reinterpret_cast<const char *>(index.data()), index.size());
 }
 
 bool LibraryManager::IsInitialized() const
@@ -4,7 +4,12 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <map>
+#include <cstdint>
 #include "story_project.h"
+#include "asset_store.h"
+#include "library_watcher.h"
+#include "thread_safe_queue.h"
 
 class LibraryManager
 {
@@ -22,14 +27,51 @@ public:
 
     void Save();
     void Scan();
+    // Applies the changes of the story directories reported by the watcher since the
+    // last call, returns true if the list of projects changed. Called by the UI thread.
+    bool Update();
 
     std::shared_ptr<StoryProject> NewProject();
 
     std::shared_ptr<StoryProject> GetStory(const std::string &uuid);
 
+    // Imported assets are shared between the stories of the library (see AssetStore)
+    void SetShareAssets(bool share) { m_shareAssets = share; }
+    bool IsSharingAssets() const { return m_shareAssets; }
+    AssetStore &GetAssetStore() { return m_assetStore; }
+
 private:
+    // Story information read from a project file, valid while the file does not change
+    struct CacheEntry {
+        std::string name;
+        std::string titleImage;
+        std::string titleSound;
+        int version{0};
+        uint64_t size{0};
+        int64_t mtime{0};
+    };
+
+    // Story information read by the watcher thread
+    struct StoryUpdate {
+        std::string uuid;
+        bool found{false}; // false: the story is not in the library anymore
+        bool rescan{false};
+        CacheEntry info;
+    };
+
     std::string m_library_path;
     std::vector<std::shared_ptr<StoryProject>> m_projectsList;
+    std::map<std::string, CacheEntry> m_cache; // key: story uuid
+    AssetStore m_assetStore;
+    bool m_shareAssets{false};
+    ThreadSafeQueue<StoryUpdate> m_updates;
+    LibraryWatcher m_watcher; // Last member, stopped before the queue is destroyed
+
+    void OnStoriesChanged(const std::string &library_path, const std::set<std::string> &uuids, bool rescan);
+    std::shared_ptr<StoryProject> MakeProject(const std::string &uuid, const CacheEntry &info) const;
+    static bool ReadEntry(const std::filesystem::path &file, CacheEntry &info);
+    void LoadCache();
+    void SaveCache();
 };
 
 #endif // LIBRARYMANAGER_H
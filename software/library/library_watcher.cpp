@@ -0,0 +1,238 @@
+#include "library_watcher.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "uuid.h"
+
+#ifdef __linux__
+
+// Quiet time after the last event of a story before it is reported
+static const int cDebounceMs = 300;
+
+static const uint32_t cLibraryEvents = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+// The project file is replaced by a rename when saved, the directory is watched instead of the file
+static const uint32_t cStoryEvents = IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+static bool IsProjectFile(const char *name)
+{
+    return (std::strcmp(name, "project.bin") == 0) || (std::strcmp(name, "project.json") == 0);
+}
+
+LibraryWatcher::~LibraryWatcher()
+{
+    Stop();
+}
+
+bool LibraryWatcher::Start(const std::filesystem::path &directory, Callback callback)
+{
+    Stop();
+
+    m_directory = directory;
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_stopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_inotify >= 0)
+    {
+        m_libraryWatch = inotify_add_watch(m_inotify, directory.string().c_str(), cLibraryEvents);
+    }
+    if ((m_inotify < 0) || (m_stopEvent < 0) || (m_libraryWatch < 0))
+    {
+        std::cout << "Cannot watch the library " << directory << ": " << std::strerror(errno) << std::endl;
+        Stop();
+        return false;
+    }
+
+    // Before the thread is started, so that no change is missed by a scan done after Start()
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, ec))
+    {
+        std::string uuid = entry.path().filename().string();
+        if (entry.is_directory() && UUID::IsValid(uuid))
+        {
+            WatchStory(entry.path(), uuid);
+        }
+    }
+
+    m_thread = std::thread(&LibraryWatcher::Run, this, std::move(callback));
+    return true;
+}
+
+void LibraryWatcher::Stop()
+{
+    if (m_thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(m_stopEvent, &one, sizeof(one)) != sizeof(one))
+        {
+            std::cout << "Cannot stop the library watcher" << std::endl;
+        }
+        m_thread.join();
+    }
+
+    if (m_inotify >= 0)
+    {
+        close(m_inotify);
+    }
+    if (m_stopEvent >= 0)
+    {
+        close(m_stopEvent);
+    }
+    m_inotify = -1;
+    m_stopEvent = -1;
+    m_libraryWatch = -1;
+    m_storyWatches.clear();
+}
+
+void LibraryWatcher::WatchStory(const std::filesystem::path &directory, const std::string &uuid)
+{
+    int wd = inotify_add_watch(m_inotify, directory.string().c_str(), cStoryEvents);
+    if (wd >= 0)
+    {
+        m_storyWatches[wd] = uuid;
+    }
+    else
+    {
+        // ENOSPC: see /proc/sys/fs/inotify/max_user_watches
+        std::cout << "Cannot watch the story " << directory << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+void LibraryWatcher::Run(Callback callback)
+{
+    std::set<std::string> changed;
+    bool rescan = false;
+    auto lastEvent = std::chrono::steady_clock::now();
+
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd fds[2] = { { m_inotify, POLLIN, 0 }, { m_stopEvent, POLLIN, 0 } };
+
+    while (true)
+    {
+        int timeout = -1;
+        if (!changed.empty() || rescan)
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastEvent).count();
+            timeout = std::max(0, cDebounceMs - static_cast<int>(elapsed));
+        }
+
+        if (poll(fds, 2, timeout) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cout << "Library watcher stopped: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+
+        if (fds[0].revents == 0)
+        {
+            // Quiet time elapsed
+            callback(changed, rescan);
+            changed.clear();
+            rescan = false;
+            continue;
+        }
+
+        ssize_t length;
+        while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *ptr = buffer; ptr < buffer + length; )
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    rescan = true;
+                }
+                else if (event->wd == m_libraryWatch)
+                {
+                    std::string uuid = (event->len > 0) ? event->name : "";
+                    if (!(event->mask & IN_ISDIR) || !UUID::IsValid(uuid))
+                    {
+                        continue;
+                    }
+
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    {
+                        // The project file can already be there (story moved in the library)
+                        WatchStory(m_directory / uuid, uuid);
+                    }
+                    else if (event->mask & IN_MOVED_FROM)
+                    {
+                        // Still watched at its new place otherwise
+                        for (auto it = m_storyWatches.begin(); it != m_storyWatches.end(); ++it)
+                        {
+                            if (it->second == uuid)
+                            {
+                                inotify_rm_watch(m_inotify, it->first);
+                                m_storyWatches.erase(it);
+                                break;
+                            }
+                        }
+                    }
+                    changed.insert(uuid);
+                }
+                else
+                {
+                    auto it = m_storyWatches.find(event->wd);
+                    if (it == m_storyWatches.end())
+                    {
+                        continue;
+                    }
+                    if (event->mask & IN_IGNORED)
+                    {
+                        // Story directory deleted or moved out of the library
+                        m_storyWatches.erase(it);
+                    }
+                    else if ((event->len > 0) && IsProjectFile(event->name))
+                    {
+                        changed.insert(it->second);
+                    }
+                }
+            }
+        }
+        lastEvent = std::chrono::steady_clock::now();
+    }
+}
+
+#else
+
+LibraryWatcher::~LibraryWatcher()
+{
+}
+
+bool LibraryWatcher::Start(const std::filesystem::path &, Callback)
+{
+    return false;
+}
+
+void LibraryWatcher::Stop()
+{
+}
+
+void LibraryWatcher::WatchStory(const std::filesystem::path &, const std::string &)
+{
+}
+
+void LibraryWatcher::Run(Callback)
+{
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef LIBRARY_WATCHER_H
+#define LIBRARY_WATCHER_H
+
+#include <set>
+#include <map>
+#include <string>
+#include <thread>
+#include <functional>
+#include <filesystem>
+
+// Watches the story directories of a library and reports, from its own thread, the
+// stories whose directory or project file was added, changed or removed. The events
+// are debounced: a story is reported when its changes stop for a short time (copying
+// a story or saving a project makes several events).
+// Linux only (inotify); on the other systems Start() fails and the library is only
+// updated by a scan.
+class LibraryWatcher
+{
+public:
+    // rescan: events were lost, the whole library must be scanned again
+    using Callback = std::function<void(const std::set<std::string> &uuids, bool rescan)>;
+
+    ~LibraryWatcher();
+
+    bool Start(const std::filesystem::path &directory, Callback callback);
+    void Stop();
+    bool IsRunning() const { return m_thread.joinable(); }
+
+private:
+    std::thread m_thread;
+    std::filesystem::path m_directory;
+    int m_inotify{-1};
+    int m_stopEvent{-1};
+    int m_libraryWatch{-1};
+    std::map<int, std::string> m_storyWatches; // key: watch descriptor, value: story uuid
+
+    void WatchStory(const std::filesystem::path &directory, const std::string &uuid);
+    void Run(Callback callback);
+};
+
+#endif // LIBRARY_WATCHER_H
@@ -0,0 +1,224 @@
+#include "project_journal.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+
+ProjectJournal::~ProjectJournal()
+{
+    Close();
+}
+
+void ProjectJournal::Open(const std::filesystem::path &fileName)
+{
+    Close();
+    m_fileName = fileName;
+
+    // Entries of a previous session, already replayed in the node graph. The
+    // pending ones are left by a save that did not complete.
+    bool complete = true;
+    bool pendingComplete = true;
+    m_entries = CountEntries(fileName, complete) + CountEntries(PendingFileName(fileName), pendingComplete);
+    if (!pendingComplete)
+    {
+        std::ofstream(PendingFileName(fileName), std::ios::out | std::ios::app) << '\n';
+    }
+
+    m_file.open(fileName, std::ios::out | std::ios::app);
+    if (!complete)
+    {
+        m_file << '\n';
+    }
+}
+
+void ProjectJournal::Close()
+{
+    m_file.close();
+    m_fileName.clear();
+    m_entries = 0;
+    m_pendingEntries = 0;
+}
+
+void ProjectJournal::Clear()
+{
+    if (IsOpen())
+    {
+        m_file.close();
+        m_file.open(m_fileName, std::ios::out | std::ios::trunc);
+        std::error_code ec;
+        std::filesystem::remove(PendingFileName(m_fileName), ec);
+        m_entries = 0;
+        m_pendingEntries = 0;
+    }
+}
+
+void ProjectJournal::BeginSave()
+{
+    if (!IsOpen())
+    {
+        return;
+    }
+
+    m_file.close();
+    std::filesystem::path pending = PendingFileName(m_fileName);
+    std::error_code ec;
+    if (std::filesystem::exists(pending, ec))
+    {
+        // Entries of a failed save, still to be saved
+        std::ifstream journal(m_fileName, std::ios::binary);
+        std::ofstream(pending, std::ios::out | std::ios::app | std::ios::binary) << journal.rdbuf();
+    }
+    else
+    {
+        std::filesystem::rename(m_fileName, pending, ec);
+    }
+
+    m_file.open(m_fileName, std::ios::out | std::ios::trunc);
+    m_pendingEntries = m_entries;
+    m_entries = 0;
+}
+
+void ProjectJournal::EndSave(bool success)
+{
+    if (success)
+    {
+        std::error_code ec;
+        std::filesystem::remove(PendingFileName(m_fileName), ec);
+    }
+    else
+    {
+        m_entries += m_pendingEntries;
+    }
+    m_pendingEntries = 0;
+}
+
+void ProjectJournal::NodeChanged(const nlohmann::json &node)
+{
+    Append("node", "node", node);
+}
+
+void ProjectJournal::LinkAdded(const nlohmann::json &connection)
+{
+    Append("link-add", "link", connection);
+}
+
+void ProjectJournal::LinkDeleted(const nlohmann::json &connection)
+{
+    Append("link-delete", "link", connection);
+}
+
+void ProjectJournal::Append(const std::string &op, const std::string &key, const nlohmann::json &data)
+{
+    if (!IsOpen())
+    {
+        return;
+    }
+
+    nlohmann::json entry;
+    entry["op"] = op;
+    entry[key] = data;
+
+    // Flushed, so that the entry survives a crash of the application
+    m_file << entry.dump() << '\n';
+    m_file.flush();
+    m_entries++;
+}
+
+size_t ProjectJournal::Replay(const std::filesystem::path &fileName, nlohmann::json &model)
+{
+    // The pending entries are older than the ones of the journal
+    return ReplayFile(PendingFileName(fileName), model) + ReplayFile(fileName, model);
+}
+
+std::filesystem::path ProjectJournal::PendingFileName(const std::filesystem::path &fileName)
+{
+    std::filesystem::path pending = fileName;
+    pending += ".pending";
+    return pending;
+}
+
+size_t ProjectJournal::CountEntries(const std::filesystem::path &fileName, bool &complete)
+{
+    std::ifstream f(fileName);
+    std::string line;
+    size_t count = 0;
+    complete = true;
+    while (std::getline(f, line))
+    {
+        count++;
+        complete = !f.eof(); // No end of line after the last entry of a crash
+    }
+    return count;
+}
+
+size_t ProjectJournal::ReplayFile(const std::filesystem::path &fileName, nlohmann::json &model)
+{
+    std::ifstream f(fileName);
+    if (!f.is_open())
+    {
+        return 0;
+    }
+
+    nlohmann::json &nodes = model["nodes"];
+    nlohmann::json &connections = model["connections"];
+    if (!nodes.is_array())
+    {
+        nodes = nlohmann::json::array();
+    }
+    if (!connections.is_array())
+    {
+        connections = nlohmann::json::array();
+    }
+
+    std::unordered_map<int, size_t> nodeIndex; // key: node id, value: position in the array
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        nodeIndex[nodes[i]["id"].get<int>()] = i;
+    }
+
+    size_t count = 0;
+    std::string line;
+    while (std::getline(f, line))
+    {
+        // The last line can be incomplete after a crash
+        nlohmann::json entry = nlohmann::json::parse(line, nullptr, false);
+        if (entry.is_discarded() || !entry.contains("op"))
+        {
+            std::cout << "Journal entry ignored: " << line << std::endl;
+            continue;
+        }
+
+        std::string op = entry["op"].get<std::string>();
+        if (op == "node")
+        {
+            const nlohmann::json &node = entry["node"];
+            int id = node["id"].get<int>();
+            auto it = nodeIndex.find(id);
+            if (it != nodeIndex.end())
+            {
+                nodes[it->second] = node;
+            }
+            else
+            {
+                nodeIndex[id] = nodes.size();
+                nodes.push_back(node);
+            }
+        }
+        else if ((op == "link-add") || (op == "link-delete"))
+        {
+            const nlohmann::json &link = entry["link"];
+            auto it = std::find(connections.begin(), connections.end(), link);
+            if ((op == "link-add") && (it == connections.end()))
+            {
+                connections.push_back(link);
+            }
+            else if ((op == "link-delete") && (it != connections.end()))
+            {
+                connections.erase(it);
+            }
+        }
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,55 @@
+#ifndef PROJECT_JOURNAL_H
+#define PROJECT_JOURNAL_H
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+
+#include "json.hpp"
+
+// Append-only log of the node graph changes since the last project save, one JSON
+// object per line. Recording a change costs the size of the change, not the size
+// of the project. The entries are replayed over the saved node graph when the
+// project is opened again (after a crash or a close without saving), and the
+// journal is cleared by a full save.
+class ProjectJournal
+{
+public:
+    ~ProjectJournal();
+
+    void Open(const std::filesystem::path &fileName);
+    void Close();
+    bool IsOpen() const { return m_file.is_open(); }
+
+    // After a full save, the entries are in the project file
+    void Clear();
+
+    // Save on another thread: the entries recorded so far are set aside in a pending
+    // file while the new changes go to an empty journal. EndSave() deletes the pending
+    // entries if the save succeeded, they are kept for the next save otherwise.
+    void BeginSave();
+    void EndSave(bool success);
+    size_t Entries() const { return m_entries; }
+
+    // Added, moved or edited node: the node as saved in the node graph
+    void NodeChanged(const nlohmann::json &node);
+    void LinkAdded(const nlohmann::json &connection);
+    void LinkDeleted(const nlohmann::json &connection);
+
+    // Applies the changes of a journal (pending entries first) to a node graph, returns
+    // the number of changes. A change already present in the node graph is ignored.
+    static size_t Replay(const std::filesystem::path &fileName, nlohmann::json &model);
+
+private:
+    std::filesystem::path m_fileName;
+    std::ofstream m_file;
+    size_t m_entries{0};
+    size_t m_pendingEntries{0};
+
+    static std::filesystem::path PendingFileName(const std::filesystem::path &fileName);
+    static size_t CountEntries(const std::filesystem::path &fileName, bool &complete);
+    static size_t ReplayFile(const std::filesystem::path &fileName, nlohmann::json &model);
+    void Append(const std::string &op, const std::string &key, const nlohmann::json &data);
+};
+
+#endif // PROJECT_JOURNAL_H
@@ -9,68 +9,70 @@
 
 struct Resource
 {
-    std::string file;
+    enum Type { TYPE_IMAGE, TYPE_SOUND, TYPE_OTHER, TYPE_COUNT };
+
+    std::string file; // Lookup key of the ResourceManager, not changed once added
     std::string description;
     std::string format;
-    std::string type;
+    Type type{TYPE_OTHER};
+    std::string hash; // Content in the library asset store, empty if not shared
+
+    // Names used in the project files
+    static Type TypeFromString(const std::string &type) {
+        if (type == "image") {
+            return TYPE_IMAGE;
+        } else if (type == "sound") {
+            return TYPE_SOUND;
+        }
+        return TYPE_OTHER;
+    }
 
-    ~Resource() {
-        std::cout << "Res deleted" << std::endl;
+    static std::string TypeToString(Type type) {
+        switch (type) {
+        case TYPE_IMAGE: return "image";
+        case TYPE_SOUND: return "sound";
+        default: return "other";
+        }
     }
 };
 
-// Itérateur pour parcourir les éléments filtrés
-class FilterIterator {
+// Itérateur sur les ressources d'un index (toutes les ressources si pas d'index)
+class ResourceIterator {
 public:
-    using Iterator = std::list<std::shared_ptr<Resource>>::const_iterator;
+    using Items = std::vector<std::shared_ptr<Resource>>;
+    using Indexes = std::vector<size_t>;
 
 public:
-    FilterIterator(Iterator start, Iterator end, const std::string &type)
-        : current(start), end(end), filterType(type) {
-        searchNext();
+    ResourceIterator(const Items *items, const Indexes *indexes, size_t pos)
+        : m_items(items), m_indexes(indexes), m_pos(pos) {
     }
 
-    // Surcharge de l'opérateur de déréférencement
     const std::shared_ptr<Resource>& operator*() const {
-        return *current;
+        return (*m_items)[Index()];
     }
 
-    const Iterator Current() const {
-        return current;
+    // Position in the ResourceManager store
+    size_t Index() const {
+        return m_indexes ? (*m_indexes)[m_pos] : m_pos;
     }
 
-    // Surcharge de l'opérateur d'incrémentation
-    FilterIterator& operator++() {
-        ++current;
-        searchNext();
+    ResourceIterator& operator++() {
+        ++m_pos;
         return *this;
     }
 
-    // Surcharge de l'opérateur d'égalité
-    bool operator==(const FilterIterator& other) const {
-        return current == other.current;
+    bool operator==(const ResourceIterator& other) const {
+        return m_pos == other.m_pos;
     }
 
-    // Surcharge de l'opérateur de différence
-    bool operator!=(const FilterIterator& other) const {
+    bool operator!=(const ResourceIterator& other) const {
         return !(*this == other);
     }
 
 private:
-    Iterator current;
-    Iterator end;
-    std::string filterType;
-
-    // Fonction pour trouver le prochain élément qui correspond au filtre
-    void searchNext() {
-
-        if (filterType != "")
-        {
-            while (current != end && (*current)->type != filterType) {
-                ++current;
-            }
-        }
-    }
+    const Items *m_items;
+    const Indexes *m_indexes;
+    size_t m_pos;
 };
 
 
@@ -4,19 +4,18 @@
 #include <memory>
 #include <string>
 #include <vector>
-#include <iostream>
-#include <ranges>
+#include <unordered_map>
 
 #include "resource.h"
 
+// Resources of a project, in their order of insertion, indexed by type and by file name.
+// The iterators are invalidated by Add(), Delete() and Clear().
 class ResourceManager
 {
 public:
+    using Range = std::pair<ResourceIterator, ResourceIterator>;
 
-    ResourceManager()
-        : m_images(filter("image"))
-        , m_sounds(filter("sound"))
-    {
+    ResourceManager() {
 
     }
 
@@ -24,56 +23,83 @@ public:
 
     }
 
+    // A resource with the same file name replaces the previous one
     void Add(std::shared_ptr<Resource> res)
     {
-        m_items.push_back(res);
-        UpdateIterators();
+        auto it = m_byFile.find(res->file);
+        if (it != m_byFile.end())
+        {
+            m_items[it->second] = res;
+            UpdateIndexes();
+        }
+        else
+        {
+            m_byFile[res->file] = m_items.size();
+            m_byType[res->type].push_back(m_items.size());
+            m_items.push_back(res);
+        }
     }
 
-    void Delete(FilterIterator &it)
+    void Delete(const ResourceIterator &it)
     {
-        m_items.erase(it.Current());
+        m_items.erase(m_items.begin() + it.Index());
+        UpdateIndexes();
     }
 
     void Clear()
     {
         m_items.clear();
-        UpdateIterators();
+        UpdateIndexes();
     }
 
+    std::shared_ptr<Resource> Find(const std::string &file) const
+    {
+        auto it = m_byFile.find(file);
+        return (it != m_byFile.end()) ? m_items[it->second] : nullptr;
+    }
 
-    // Fonction pour créer un itérateur de début et de fin pour les éléments filtrés
-    std::pair<FilterIterator, FilterIterator> filter(const std::string &type) const {
-        auto begin = std::begin(m_items);
-        auto end = std::end(m_items);
-        return std::make_pair(FilterIterator(begin, end, type), FilterIterator(end, end, type));
+    size_t Count() const { return m_items.size(); }
+
+    Range Items() const
+    {
+        return std::make_pair(ResourceIterator(&m_items, nullptr, 0), ResourceIterator(&m_items, nullptr, m_items.size()));
     }
 
-    std::pair<FilterIterator, FilterIterator> Items()
+    Range Items(Resource::Type type) const
     {
-        return filter("");
+        const auto &indexes = m_byType[type];
+        return std::make_pair(ResourceIterator(&m_items, &indexes, 0), ResourceIterator(&m_items, &indexes, indexes.size()));
     }
 
-    std::pair<FilterIterator, FilterIterator> Images()
+    Range Images() const
     {
-        return m_images;
+        return Items(Resource::TYPE_IMAGE);
     }
 
-    std::pair<FilterIterator, FilterIterator> Sounds()
+    Range Sounds() const
     {
-        return m_sounds;
+        return Items(Resource::TYPE_SOUND);
     }
 
 
 private:
-    std::list<std::shared_ptr<Resource>> m_items;
-    std::pair<FilterIterator, FilterIterator> m_images;
-    std::pair<FilterIterator, FilterIterator> m_sounds;
+    std::vector<std::shared_ptr<Resource>> m_items;
+    std::vector<size_t> m_byType[Resource::TYPE_COUNT];
+    std::unordered_map<std::string, size_t> m_byFile;
 
-    void UpdateIterators()
+    void UpdateIndexes()
     {
-        m_images = filter("image");
-        m_sounds = filter("sound");
+        for (auto &indexes : m_byType)
+        {
+            indexes.clear();
+        }
+        m_byFile.clear();
+
+        for (size_t i = 0; i < m_items.size(); i++)
+        {
+            m_byType[m_items[i]->type].push_back(i);
+            m_byFile[m_items[i]->file] = i;
+        }
     }
 
 };
@@ -3,8 +3,22 @@
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <map>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "json.hpp"
+#include "project_journal.h"
 
 StoryProject::StoryProject()
 {
@@ -18,7 +32,7 @@ StoryProject::~StoryProject()
 void StoryProject::SetPaths(const std::string &uuid, const std::string &library_path)
 {
     m_uuid = uuid;
-    m_project_file_path = std::filesystem::path(library_path) / uuid / std::filesystem::path("project.json");
+    m_project_file_path = std::filesystem::path(library_path) / uuid / std::filesystem::path("project.bin");
 
     m_working_dir = m_project_file_path.parent_path().generic_string();
     m_assetsPath = m_working_dir /  std::filesystem::path("assets");
@@ -70,133 +84,468 @@ bool StoryProject::ParseStoryInformation(nlohmann::json &j)
 }
 
 
-bool StoryProject::Load(nlohmann::json &model, ResourceManager &manager)
+// Project container: magic, format version, number of sections and a table of
+// sections (4 characters name, offset and size from the beginning of the file).
+// Every section is a CBOR document, read independently of the other ones.
+static const char cContainerMagic[4] = { 'O', 'S', 'T', 'P' };
+static const uint32_t cContainerVersion = 1;
+static const size_t cWriteBlockSize = 1024 * 1024;
+
+static void WriteU32(std::ostream &o, uint32_t value)
 {
-    try {
-        std::ifstream f(m_project_file_path);
-        nlohmann::json j = nlohmann::json::parse(f);
+    char bytes[4];
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+    o.write(bytes, 4);
+}
 
-        manager.Clear();
+static uint32_t ReadU32(std::istream &i)
+{
+    unsigned char bytes[4] = { 0 };
+    i.read(reinterpret_cast<char *>(bytes), 4);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+static bool ReadSection(const std::filesystem::path &fileName, const std::string &name, nlohmann::json &data)
+{
+    std::ifstream f(fileName, std::ios::binary);
+    char magic[4] = { 0 };
+    f.read(magic, 4);
+    if (!f || (std::memcmp(magic, cContainerMagic, 4) != 0) || (ReadU32(f) != cContainerVersion))
+    {
+        return false;
+    }
 
-        if (ParseStoryInformation(j))
+    uint32_t count = ReadU32(f);
+    for (uint32_t i = 0; (i < count) && f; i++)
+    {
+        char sectionName[4];
+        f.read(sectionName, 4);
+        uint32_t offset = ReadU32(f);
+        uint32_t size = ReadU32(f);
+
+        if (f && (std::string(sectionName, 4) == name))
         {
-            if (j.contains("resources"))
+            std::vector<uint8_t> buffer(size);
+            f.seekg(offset);
+            f.read(reinterpret_cast<char *>(buffer.data()), size);
+            if (!f)
             {
-                nlohmann::json resourcesData = j["resources"];
-
-                for (const auto &obj : resourcesData)
-                {
-                    auto rData = std::make_shared<Resource>();
-
-                    rData->type = obj["type"].get<std::string>();
-                    rData->format = obj["format"].get<std::string>();
-                    rData->description = obj["description"].get<std::string>();
-                    rData->file = obj["file"].get<std::string>();
-                    manager.Add(rData);
-                }
-
-                if (j.contains("nodegraph"))
-                {
-                    model = j["nodegraph"];
-                    m_initialized = true;
-                }
+                return false;
             }
+            data = nlohmann::json::from_cbor(buffer);
+            return true;
         }
+    }
+    return false;
+}
 
- /*
-
-        if (j.contains("nodes"))
-        {
-            for (auto& element : j["nodes"])
-            {
-                StoryNode n;
+static void LoadResources(const nlohmann::json &resourcesData, ResourceManager &manager)
+{
+    for (const auto &obj : resourcesData)
+    {
+        auto rData = std::make_shared<Resource>();
+
+        rData->type = Resource::TypeFromString(obj["type"].get<std::string>());
+        rData->format = obj["format"].get<std::string>();
+        rData->description = obj["description"].get<std::string>();
+        rData->file = obj["file"].get<std::string>();
+        rData->hash = obj.value("hash", "");
+        manager.Add(rData);
+    }
+}
 
-                n.auto_jump = element["auto_jump"];
+static std::vector<Resource> CopyResources(ResourceManager &manager)
+{
+    std::vector<Resource> resources;
+    resources.reserve(manager.Count());
 
-                for (auto& jump : element["jumps"])
-                {
-                    n.jumps.push_back(jump.get<int>());
-                }
+    auto [b, e] = manager.Items();
+    for (auto it = b; it != e; ++it)
+    {
+        resources.push_back(**it);
+    }
+    return resources;
+}
 
-                n.id = element["id"];
-                n.image = element["image"];
-                n.sound = element["sound"];
+static nlohmann::ordered_json SaveResources(const std::vector<Resource> &resources)
+{
+    nlohmann::ordered_json resourcesData = nlohmann::ordered_json::array();
 
-                m_nodes.push_back(n);
-            }
+    for (const auto &r : resources)
+    {
+        nlohmann::ordered_json obj = {{"type", Resource::TypeToString(r.type)},
+                              {"format", r.format},
+                              {"description", r.description},
+                              {"file", r.file}};
+        if (!r.hash.empty())
+        {
+            obj["hash"] = r.hash;
         }
 
-        m_images.clear();
-        if (j.contains("images"))
+        resourcesData.push_back(obj);
+    }
+    return resourcesData;
+}
+
+// Reads only the "project" object of a project file, then stops the parsing:
+// the node graph is not loaded in memory
+class StoryInformationReader : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+    std::map<std::string, std::string> fields;
+    bool done{false};
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t) override { return true; }
+    bool number_unsigned(number_unsigned_t) override { return true; }
+    bool number_float(number_float_t, const string_t &) override { return true; }
+    bool binary(binary_t &) override { return true; }
+
+    bool string(string_t &val) override
+    {
+        if (m_inProject && (m_depth == 2))
         {
-            for (auto& element : j["images"])
-            {
-                Resource r;
+            fields[m_key] = val;
+        }
+        return true;
+    }
 
-                r.file = element["file"];
-                r.description = element["description"];
-                r.format = element["format"];
+    bool key(string_t &val) override
+    {
+        m_key = val;
+        return true;
+    }
 
-                m_images.push_back(r);
-            }
+    bool start_object(std::size_t) override
+    {
+        m_depth++;
+        if ((m_depth == 2) && (m_key == "project"))
+        {
+            m_inProject = true;
         }
+        return true;
+    }
 
-        m_sounds.clear();
-        if (j.contains("sounds"))
+    bool end_object() override
+    {
+        if (m_inProject && (m_depth == 2))
         {
-            for (auto& element : j["sounds"])
-            {
-                Resource r;
+            done = true;
+            return false; // Stop here
+        }
+        m_depth--;
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        m_depth++;
+        return true;
+    }
 
-                r.file = element["file"];
-                r.description = element["description"];
-                r.format = element["format"];
+    bool end_array() override
+    {
+        m_depth--;
+        return true;
+    }
 
-                m_sounds.push_back(r);
-            }
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &) override
+    {
+        return false;
+    }
+
+private:
+    int m_depth{0};
+    bool m_inProject{false};
+    std::string m_key;
+};
+
+bool StoryProject::ReadStoryInformation(const std::filesystem::path &fileName)
+{
+    if (fileName.extension() == ".bin")
+    {
+        nlohmann::json header;
+        try {
+            return ReadSection(fileName, "HEAD", header) && ParseStoryInformation(header);
+        }
+        catch(std::exception &)
+        {
+            return false;
         }
+    }
 
-        m_type = j["type"];
-        m_code = j["code"];
-        m_name = j["name"];
+    std::ifstream f(fileName);
+    StoryInformationReader reader;
+    nlohmann::json::sax_parse(f, &reader);
 
-        success = true;
+    if (!reader.done || (reader.fields.count("name") == 0) || (reader.fields.count("uuid") == 0))
+    {
+        return false;
+    }
 
-*/
+    m_name = reader.fields["name"];
+    m_uuid = reader.fields["uuid"];
+    m_titleImage = reader.fields["title_image"];
+    m_titleSound = reader.fields["title_sound"];
+    return true;
+}
+
+std::filesystem::path StoryProject::FindProjectFile(const std::filesystem::path &dir)
+{
+    std::filesystem::path container = dir / "project.bin";
+    std::filesystem::path json = dir / "project.json";
+
+    // A JSON file more recent than the container is an import
+    std::error_code ec1, ec2;
+    auto containerTime = std::filesystem::last_write_time(container, ec1);
+    auto jsonTime = std::filesystem::last_write_time(json, ec2);
+
+    if (!ec1 && (ec2 || (containerTime >= jsonTime)))
+    {
+        return container;
+    }
+    return json;
+}
+
+bool StoryProject::Load(ResourceManager &manager)
+{
+    m_initialized = false;
+    m_importedGraph = nlohmann::json();
+
+    try {
+        manager.Clear();
+
+        std::filesystem::path fileName = FindProjectFile(m_working_dir);
+        if (fileName.extension() == ".bin")
+        {
+            nlohmann::json header;
+            nlohmann::json resourcesData;
+
+            m_initialized = ReadSection(fileName, "HEAD", header) &&
+                            ParseStoryInformation(header) &&
+                            ReadSection(fileName, "RSRC", resourcesData);
+            if (m_initialized)
+            {
+                LoadResources(resourcesData, manager);
+            }
+        }
+        else
+        {
+            std::ifstream f(fileName);
+            nlohmann::json j = nlohmann::json::parse(f);
+
+            if (ParseStoryInformation(j) && j.contains("resources") && j.contains("nodegraph"))
+            {
+                LoadResources(j["resources"], manager);
+                // Kept until LoadNodeGraph(), there is no section to read it again
+                m_importedGraph = std::move(j["nodegraph"]);
+                m_initialized = true;
+            }
+        }
     }
     catch(std::exception &e)
     {
         std::cout << e.what() << std::endl;
+        m_initialized = false;
     }
 
     return m_initialized;
 }
 
-void StoryProject::Save(const nlohmann::json &model, ResourceManager &manager)
+bool StoryProject::LoadNodeGraph(nlohmann::json &model)
 {
-    nlohmann::json j;
-    j["project"] = { {"name", m_name}, {"uuid", m_uuid}, { "title_image", m_titleImage }, { "title_sound", m_titleSound } };
+    bool success = false;
+    if (!m_importedGraph.is_null())
+    {
+        model = std::move(m_importedGraph);
+        m_importedGraph = nlohmann::json();
+        success = true;
+    }
+    else
+    {
+        try {
+            success = ReadSection(m_project_file_path, "GRPH", model);
+        }
+        catch(std::exception &e)
+        {
+            std::cout << e.what() << std::endl;
+        }
+    }
 
+    // Changes not saved in the project file
+    if (success)
     {
-        nlohmann::json resourcesData;
+        size_t changes = ProjectJournal::Replay(GetJournalFilePath(), model);
+        if (changes > 0)
+        {
+            std::cout << changes << " changes restored from the journal" << std::endl;
+        }
+    }
+    return success;
+}
 
-        auto [b, e] = manager.Items();
-        for (auto it = b; it != e; ++it)
+// Container: a table of the sections, then the HEAD, RSRC and GRPH sections in CBOR
+static bool WriteContainer(const std::filesystem::path &fileName, const nlohmann::json &header, const nlohmann::ordered_json &resources,
+                           const nlohmann::json &nodegraph, std::string &error, std::atomic<float> *progress)
+{
+    auto setProgress = [progress](float value) {
+        if (progress)
         {
-            nlohmann::json obj = {{"type", (*it)->type},
-                                  {"format", (*it)->format},
-                                  {"description", (*it)->description},
-                                  {"file", (*it)->file}};
+            progress->store(value);
+        }
+    };
+
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> sections;
+    sections.emplace_back("HEAD", nlohmann::json::to_cbor(header));
+    sections.emplace_back("RSRC", nlohmann::ordered_json::to_cbor(resources));
+    setProgress(0.1f);
+    sections.emplace_back("GRPH", nlohmann::json::to_cbor(nodegraph));
+    setProgress(0.5f);
+
+    std::ostringstream table;
+    table.write(cContainerMagic, 4);
+    WriteU32(table, cContainerVersion);
+    WriteU32(table, sections.size());
+    uint32_t offset = 12 + sections.size() * 12;
+    size_t total = 0;
+    for (const auto &s : sections)
+    {
+        table.write(s.first.data(), 4);
+        WriteU32(table, offset);
+        WriteU32(table, s.second.size());
+        offset += s.second.size();
+        total += s.second.size();
+    }
 
-            resourcesData.push_back(obj);
+    // Written next to the previous one, which is kept if anything goes wrong
+    std::filesystem::path tmp = fileName;
+    tmp += ".tmp";
+    FILE *f = std::fopen(tmp.string().c_str(), "wb");
+    if (f == nullptr)
+    {
+        error = "Cannot write " + tmp.string();
+        return false;
+    }
+
+    std::string tableData = table.str();
+    bool ok = std::fwrite(tableData.data(), 1, tableData.size(), f) == tableData.size();
+    size_t written = 0;
+    for (const auto &s : sections)
+    {
+        // By blocks, for the progress of the big node graphs
+        for (size_t pos = 0; ok && (pos < s.second.size()); pos += cWriteBlockSize)
+        {
+            size_t size = std::min(cWriteBlockSize, s.second.size() - pos);
+            ok = std::fwrite(s.second.data() + pos, 1, size, f) == size;
+            written += size;
+            setProgress(0.5f + 0.4f * written / total);
         }
-        j["resources"] = resourcesData;
     }
 
+    // On disk before the rename, so that a power loss leaves the old or the new file
+    ok = ok && (std::fflush(f) == 0);
+#ifdef _WIN32
+    ok = ok && (_commit(_fileno(f)) == 0);
+#else
+    ok = ok && (fsync(fileno(f)) == 0);
+#endif
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        error = "Cannot write " + tmp.string() + ": " + std::strerror(errno);
+        std::error_code ec;
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, fileName, ec);
+    if (ec)
+    {
+        error = "Cannot write " + fileName.string() + ": " + ec.message();
+        return false;
+    }
+    setProgress(1.0f);
+    return true;
+}
+
+bool StoryProject::Save(const nlohmann::json &model, ResourceManager &manager)
+{
+    std::string error;
+    Snapshot snapshot = MakeSnapshot(manager);
+    if (!WriteContainer(snapshot.fileName, snapshot.header, SaveResources(snapshot.resources), model, error, nullptr))
+    {
+        std::cout << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+nlohmann::json StoryProject::NodeToJson(const NodeData &node)
+{
+    nlohmann::json internalData = nlohmann::json::object();
+    for (const auto &d : node.data)
+    {
+        internalData[d.first] = d.second;
+    }
+
+    return { { "id", node.id },
+             { "type", node.type },
+             { "outPortCount", node.outputs },
+             { "inPortCount", node.inputs },
+             { "position", { { "x", node.x }, { "y", node.y } } },
+             { "internal-data", internalData } };
+}
+
+nlohmann::json StoryProject::GraphToJson(const std::vector<NodeData> &nodes, const std::vector<LinkData> &links)
+{
+    nlohmann::json model;
+    nlohmann::json &nodesJson = model["nodes"] = nlohmann::json::array();
+    for (const auto &n : nodes)
+    {
+        nodesJson.push_back(NodeToJson(n));
+    }
+
+    nlohmann::json &connections = model["connections"] = nlohmann::json::array();
+    for (const auto &l : links)
+    {
+        connections.push_back({ { "outNodeId", l.outNodeId }, { "outPortIndex", l.outPortIndex },
+                                { "inNodeId", l.inNodeId }, { "inPortIndex", l.inPortIndex } });
+    }
+    return model;
+}
+
+StoryProject::Snapshot StoryProject::MakeSnapshot(ResourceManager &manager) const
+{
+    Snapshot snapshot;
+    snapshot.header["project"] = { {"name", m_name}, {"uuid", m_uuid}, { "title_image", m_titleImage }, { "title_sound", m_titleSound } };
+    snapshot.resources = CopyResources(manager);
+    snapshot.fileName = m_project_file_path;
+    return snapshot;
+}
+
+bool StoryProject::WriteSnapshot(const Snapshot &snapshot, std::string &error, std::atomic<float> *progress)
+{
+    // JSON of the node graph made here, on the save thread
+    return WriteContainer(snapshot.fileName, snapshot.header, SaveResources(snapshot.resources),
+                          GraphToJson(snapshot.nodes, snapshot.links), error, progress);
+}
+
+bool StoryProject::ExportJson(const nlohmann::json &model, ResourceManager &manager, const std::filesystem::path &fileName)
+{
+    // Ordered: the project information is first in the file, for ReadStoryInformation()
+    nlohmann::ordered_json j;
+    j["project"] = { {"name", m_name}, {"uuid", m_uuid}, { "title_image", m_titleImage }, { "title_sound", m_titleSound } };
+    j["resources"] = SaveResources(CopyResources(manager));
     j["nodegraph"] = model;
 
-    std::ofstream o(m_project_file_path);
+    std::ofstream o(fileName);
     o << std::setw(4) << j << std::endl;
+    return o.good();
 }
 /*
 void StoryProject::CreateTree()
@@ -238,6 +587,7 @@ void StoryProject::Clear()
     m_uuid = "";
     m_working_dir = "";
     m_project_file_path = "";
+    m_importedGraph = nlohmann::json();
     m_initialized = false;
 }
 
@@ -287,12 +637,6 @@ std::string StoryProject::RemoveFileExtension(const std::string &FileName)
     return f;
 }
 
-std::string StoryProject::FileToConstant(const std::string &FileName, const std::string &extension)
-{
-    std::string f = RemoveFileExtension(FileName);
-    return "$" + f + " DC8 \"" + f + extension + "\", 8\r\n";
-}
-
 void StoryProject::SetTitleImage(const std::string &titleImage)
 {
     m_titleImage = titleImage;
@@ -331,6 +675,11 @@ std::string StoryProject::GetProjectFilePath() const
     return m_project_file_path;
 }
 
+std::string StoryProject::GetJournalFilePath() const
+{
+    return (m_working_dir / "project.journal").string();
+}
+
 std::string StoryProject::GetWorkingDir() const
 {
     return m_working_dir.string();
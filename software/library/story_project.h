@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <atomic>
 #include "json.hpp"
 
 #include "json.hpp"
@@ -60,8 +61,49 @@ public:
     StoryNode *m_tree;
 */
     void New(const std::string &uuid, const std::string &library_path);
-    bool Load(nlohmann::json &model, ResourceManager &manager);
-    void Save(const nlohmann::json &model, ResourceManager &manager);
+    // Project file: a container (project.bin) with the header, the resources and the
+    // node graph in separate sections. Load() reads the first two, the node graph is
+    // read by LoadNodeGraph(), with the changes of the journal. A project.json more recent
+    // than the container is imported.
+    bool Load(ResourceManager &manager);
+    bool LoadNodeGraph(nlohmann::json &model);
+    bool Save(const nlohmann::json &model, ResourceManager &manager);
+
+    // Node graph copied by the UI thread when the project is saved: plain data, the
+    // JSON model is made by GraphToJson() on the save thread
+    struct NodeData {
+        unsigned long id{0};
+        std::string type;
+        uint32_t inputs{0};
+        uint32_t outputs{0};
+        float x{0.0f};
+        float y{0.0f};
+        std::vector<std::pair<std::string, std::string>> data; //!< "internal-data" of the node
+    };
+    struct LinkData {
+        unsigned int outNodeId{0};
+        unsigned int outPortIndex{0};
+        unsigned int inNodeId{0};
+        unsigned int inPortIndex{0};
+    };
+    static nlohmann::json NodeToJson(const NodeData &node);
+    static nlohmann::json GraphToJson(const std::vector<NodeData> &nodes, const std::vector<LinkData> &links);
+
+    // Save in two steps: a copy of the project data taken by the UI thread, then the
+    // conversion to JSON/CBOR and the write to disk, which do not use the project and can
+    // run on another thread. progress goes from 0 to 1, error is set on failure.
+    struct Snapshot {
+        nlohmann::json header;
+        std::vector<Resource> resources;
+        std::vector<NodeData> nodes;
+        std::vector<LinkData> links;
+        std::filesystem::path fileName;
+    };
+    // Header and resources, the node graph is copied by the caller
+    Snapshot MakeSnapshot(ResourceManager &manager) const;
+    static bool WriteSnapshot(const Snapshot &snapshot, std::string &error, std::atomic<float> *progress = nullptr);
+    // Whole project in a single JSON document, the exchange format
+    bool ExportJson(const nlohmann::json &model, ResourceManager &manager, const std::filesystem::path &fileName);
     void SaveBinary(const std::vector<uint8_t> &m_program);
     void SetPaths(const std::string &uuid, const std::string &library_path);
 
@@ -73,8 +115,11 @@ public:
     void SetDisplayFormat(int w, int h);
     void SetName(const std::string &name) { m_name = name; }
     void SetUuid(const std::string &uuid) { m_uuid = uuid; }
+    void SetVersion(int version) { m_version = version; }
 
     std::string GetProjectFilePath() const;
+    // Node graph changes since the last save (see ProjectJournal)
+    std::string GetJournalFilePath() const;
     std::string GetWorkingDir() const;
     std::string GetName() const { return m_name; }
     std::string GetUuid() const { return m_uuid; }
@@ -89,7 +134,6 @@ public:
     static std::string GetFileName(const std::string &path);
     static std::string RemoveFileExtension(const std::string &FileName);
     static void ReplaceCharacter(std::string &theString, const std::string &toFind, const std::string &toReplace);
-    static std::string FileToConstant(const std::string &FileName, const std::string &extension);
 
     void SetTitleImage(const std::string &titleImage);
     void SetTitleSound(const std::string &titleSound);
@@ -107,6 +151,10 @@ public:
 
 
     bool ParseStoryInformation(nlohmann::json &j);
+    // Same information, read from the beginning of a project file only
+    bool ReadStoryInformation(const std::filesystem::path &fileName);
+    // Project file to open in a story directory (container or JSON)
+    static std::filesystem::path FindProjectFile(const std::filesystem::path &dir);
 private:
     // Project properties and location
     std::string m_name; /// human readable name
@@ -114,14 +162,15 @@ private:
     std::string m_titleImage;
     std::string m_titleSound;
     std::string m_description;
-    int m_version;
+    int m_version{1};
 
     std::filesystem::path m_assetsPath;
 
     bool m_initialized{false};
 
     std::filesystem::path m_working_dir; /// Temporary folder based on the uuid, where the archive is unzipped
-    std::filesystem::path m_project_file_path; /// JSON project file
+    std::filesystem::path m_project_file_path; /// Project container
+    nlohmann::json m_importedGraph; /// Node graph of an imported JSON file, until LoadNodeGraph()
 
     int m_display_w{320};
     int m_display_h{240};
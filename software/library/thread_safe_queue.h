@@ -16,7 +16,7 @@ public:
     void push(T&& item) {
         {
             std::lock_guard lock(mutex);
-            queue.push(item);
+            queue.push(std::move(item));
         }
 
         cond_var.notify_one();
@@ -3,7 +3,8 @@
 
 #include <string>
 #include <random>
-#include <regex>
+#include <cctype>
+#include <cstring>
 
 // Encaasulate the genaeration of a Version 4 UUID object
 // A Version 4 UUID is a universally unique identifier that is generated using random numbers.
@@ -48,11 +49,22 @@ public:
     }
 
     static bool IsValid(const std::string& input) {
-        // Le motif regex pour un UUID V4
-        std::regex uuidRegex("^[0-9A-F]{8}-[0-9A-F]{4}-4[0-9A-F]{3}-[89AB][0-9A-F]{3}-[0-9A-F]{12}$",std::regex_constants::icase);
-
-        // Vérifier si la chaîne correspond au motif UUID V4
-        return std::regex_match(input, uuidRegex);
+        // UUID V4: xxxxxxxx-xxxx-4xxx-[89ab]xxx-xxxxxxxxxxxx, hexadecimal in any case
+        // (no std::regex, too slow to build for each directory of a library scan)
+        if (input.size() != 36) {
+            return false;
+        }
+        for (size_t i = 0; i < input.size(); i++) {
+            char c = input[i];
+            if ((i == 8) || (i == 13) || (i == 18) || (i == 23)) {
+                if (c != '-') {
+                    return false;
+                }
+            } else if (!std::isxdigit(static_cast<unsigned char>(c))) {
+                return false;
+            }
+        }
+        return (input[14] == '4') && (std::strchr("89abAB", input[19]) != nullptr);
     }
 
     unsigned char _data[16] = {0};
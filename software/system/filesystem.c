@@ -6,6 +6,7 @@
 #include "filesystem.h"
 #include "mini_qoi.h"
 #include "serializers.h"
+#include "story_index.h"
 #include "sdcard.h"
 
 #ifdef OST_USE_FF_LIBRARY
@@ -164,18 +165,20 @@ void disk_start()
 // ===========================================================================================================
 
 static file_t IndexFile;
+static uint32_t IndexTableOffset;
 
-static uint8_t IndexBuf[260];
-static uint8_t ImageBuf[100];
-static uint8_t SoundBuf[100];
+// Window of the story table, the next stories of the home menu are usually in it
+#define INDEX_TABLE_WINDOW 32
+static uint8_t IndexTable[INDEX_TABLE_WINDOW * STORY_INDEX_ENTRY_SIZE];
+static uint32_t IndexTableFirst;
+static uint32_t IndexTableCount;
 
-static const char *IndexFileName = "index.ost";
-
-#define TLV_ARRAY_TYPE 0xAB
-#define TLV_OBJECT_TYPE 0xE7
-#define TLV_STRING_TYPE 0x3D
+// Window of the record stream, the biggest item of a record is a string
+static uint8_t IndexRecord[TLV_HEADER_SIZE + STORY_INDEX_STRING_MAX];
+static char ImageBuf[100];
+static char SoundBuf[100];
 
-#define TL_SIZE 3
+static const char *IndexFileName = "index.ost";
 
 bool filesystem_read_index_file(ost_context_t *ctx)
 {
@@ -184,83 +187,121 @@ bool filesystem_read_index_file(ost_context_t *ctx)
 
     ctx->number_of_stories = 0;
     ctx->current_story = 0;
+    IndexTableCount = 0;
 
     if (fr == FR_OK)
     {
-
         ctx->index_file_size = fno.fsize;
         UINT br;
+        uint16_t stories = 0;
 
-        bool valid_file = false;
-
-        // Minimum size of TLV is type + length, so check if there is potential data
-        if (ctx->index_file_size > TL_SIZE)
+        fr = f_open(&IndexFile, IndexFileName, FA_READ);
+        if (fr == FR_OK)
         {
-            FRESULT fr = f_open(&IndexFile, IndexFileName, FA_READ);
-            if (fr == FR_OK)
+            fr = f_read(&IndexFile, &IndexRecord[0], STORY_INDEX_HEADER_SIZE, &br);
+            if ((fr == FR_OK) && (br == STORY_INDEX_HEADER_SIZE) &&
+                story_index_header_get(&IndexRecord[0], &stories, &IndexTableOffset))
             {
-                fr = f_read(&IndexFile, &IndexBuf[0], TL_SIZE, &br);
-                if ((fr == FR_OK) && (br == TL_SIZE) && (IndexBuf[0] = TLV_ARRAY_TYPE))
-                {
-                    // nomber of stories
-                    ctx->number_of_stories = leu16_get(&IndexBuf[1]);
-                    debug_printf("SUCCESS: found %d stories\r\n", ctx->number_of_stories);
-                }
+                ctx->number_of_stories = stories;
+                debug_printf("SUCCESS: found %d stories\r\n", ctx->number_of_stories);
+            }
+            else
+            {
+                debug_printf("ERROR: index.ost invalid or old format\r\n");
             }
-        }
-        else
-        {
-            debug_printf("ERROR: index.ost not found\r\n");
         }
     }
+    else
+    {
+        debug_printf("ERROR: index.ost not found\r\n");
+    }
+
+    return ctx->number_of_stories > 0;
 }
 
-static uint32_t tlv_get_string(char *destination)
+static bool index_get_entry(uint32_t story, uint32_t *offset, uint16_t *size)
 {
-    uint32_t size = 0;
     UINT br;
-    FRESULT fr = f_read(&IndexFile, &IndexBuf[0], TL_SIZE, &br);
-    if ((fr == FR_OK) && (br == TL_SIZE) && (IndexBuf[0] = TLV_STRING_TYPE))
-    {
-        size = leu16_get(&IndexBuf[1]);
 
-        // read string, directly fill destination
-        f_read(&IndexFile, destination, size, &br);
-        if ((fr == FR_OK) && (br == size))
+    if ((story < IndexTableFirst) || (story >= IndexTableFirst + IndexTableCount))
+    {
+        // Window starting at this story
+        IndexTableFirst = story;
+        IndexTableCount = 0;
+        if (f_lseek(&IndexFile, story_index_entry_position(IndexTableOffset, story)) == FR_OK)
         {
-            // good, end propertly with zero
-            destination[size] = 0;
+            FRESULT fr = f_read(&IndexFile, &IndexTable[0], sizeof(IndexTable), &br);
+            if (fr == FR_OK)
+            {
+                IndexTableCount = br / STORY_INDEX_ENTRY_SIZE;
+            }
         }
-        else
+        if (IndexTableCount == 0)
         {
-            size = 0;
+            return false;
         }
     }
 
-    return size;
+    story_index_entry_get(&IndexTable[(story - IndexTableFirst) * STORY_INDEX_ENTRY_SIZE], offset, size);
+    return true;
 }
 
-void filesystem_get_story_title(ost_context_t *ctx)
+static uint32_t index_file_read(void *file, uint8_t *destination, uint32_t size)
 {
     UINT br;
+    FRESULT fr = f_read((FIL *)file, destination, size, &br);
+    return (fr == FR_OK) ? br : 0;
+}
 
-    ctx->current_story++;
-    if (ctx->current_story >= ctx->number_of_stories)
+static bool index_get_string(tlv_stream_t *stream, char *destination, uint32_t size)
+{
+    tlv_item_t item;
+    if (!tlv_stream_read(stream, &item) || (item.type != TLV_STRING_TYPE) || (item.length >= size))
     {
-        // Rewind to the begining of the index file data (first array element)
-        f_lseek(&IndexFile, TL_SIZE);
+        return false;
     }
+    memcpy(destination, item.value, item.length);
+    destination[item.length] = 0;
+    return true;
+}
 
-    FRESULT fr = f_read(&IndexFile, &IndexBuf[0], 3, &br);
-    if ((fr == FR_OK) && (br == 3) && (IndexBuf[0] = TLV_OBJECT_TYPE))
+void filesystem_get_story_title(ost_context_t *ctx)
+{
+    uint32_t offset;
+    uint16_t size;
+    tlv_stream_t stream;
+    tlv_item_t item;
+
+    if (ctx->number_of_stories == 0)
     {
-        tlv_get_string(ctx->uuid);
-        tlv_get_string(ImageBuf);
-        tlv_get_string(SoundBuf);
+        return;
+    }
 
+    // Stories in a loop, one seek to the record whatever the number of stories
+    uint32_t story = ctx->current_story;
+    ctx->current_story = (ctx->current_story + 1) % ctx->number_of_stories;
+
+    ctx->image = NULL;
+    ctx->sound = NULL;
+    if (!index_get_entry(story, &offset, &size) || (f_lseek(&IndexFile, offset) != FR_OK))
+    {
+        return;
+    }
+
+    // Only the first fields are read, the name and the description are not used
+    tlv_stream_init(&stream, index_file_read, &IndexFile, IndexRecord, sizeof(IndexRecord));
+    if (tlv_stream_read(&stream, &item) && (item.type == TLV_OBJECT_TYPE) &&
+        index_get_string(&stream, ctx->uuid, sizeof(ctx->uuid)) &&
+        index_get_string(&stream, ImageBuf, sizeof(ImageBuf)) &&
+        index_get_string(&stream, SoundBuf, sizeof(SoundBuf)))
+    {
         ctx->image = ImageBuf;
         ctx->sound = SoundBuf;
     }
+    else
+    {
+        debug_printf("ERROR: story %d of the index can not be read\r\n", story);
+    }
 }
 
 // ===========================================================================================================
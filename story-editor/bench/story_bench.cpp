@@ -0,0 +1,614 @@
+// Scalability benchmark of the story editor build pipeline on synthetic projects.
+//
+// The node editor needs an ImGui context (and MediaNode loads textures), so the
+// graph load and save below mirror NodeEditorWindow::Load/Save on a headless model.
+// The code generation (StoryBuilder, MediaCode), project loading/saving, the build
+// cache and the assembler are the ones of the editor.
+//
+// Usage: story_bench [--out results.json] [--keep] [nodes...]   (default: 1000 10000 100000)
+// Results are written as JSON, one entry per project size and phase.
+
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "json.hpp"
+#include "story_project.h"
+#include "project_journal.h"
+#include "chip32_assembler.h"
+#include "story_index.h"
+#include "fnv1a.h"
+#include "../src/build_cache.h"
+#include "../src/connection.h"
+#include "../src/story_builder.h"
+#include "../src/media_code.h"
+
+// Peak resident memory of the process, in KiB (0 if unknown)
+static long MaxRssKb()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+class Bench
+{
+public:
+    Bench(nlohmann::json &results, int nodes)
+        : m_results(results)
+        , m_nodes(nodes)
+    {
+    }
+
+    template<typename F>
+    bool Run(const std::string &phase, F func)
+    {
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = func(error);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        m_results.push_back({ { "nodes", m_nodes }, { "phase", phase }, { "ms", ms }, { "max_rss_kb", MaxRssKb() },
+                              { "ok", ok }, { "error", error } });
+
+        std::cerr << std::setw(8) << m_nodes << "  " << std::left << std::setw(22) << phase << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(10) << ms << " ms"
+                  << std::setw(10) << MaxRssKb() / 1024 << " MiB" << (ok ? "" : "  FAILED: " + error) << std::endl;
+        return ok;
+    }
+
+private:
+    nlohmann::json &m_results;
+    int m_nodes;
+};
+
+// ------------------------------------------------------------------------------------------------
+// Synthetic project
+// ------------------------------------------------------------------------------------------------
+
+// Node graph like the ones drawn in the editor: mostly transitions, some choices
+// of 2 to 4 branches toward the next nodes, end nodes, shared media and some
+// nodes without sound. The same size always generates the same project.
+static nlohmann::json GenerateProject(int nbNodes)
+{
+    std::mt19937 rng(nbNodes);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    int nbImages = std::max(1, nbNodes / 2);
+    int nbSounds = std::max(1, nbNodes / 4);
+
+    nlohmann::json j;
+    j["project"] = { { "name", "Bench " + std::to_string(nbNodes) },
+                     { "uuid", "bench-" + std::to_string(nbNodes) },
+                     { "title_image", "image0.png" },
+                     { "title_sound", "sound0.mp3" } };
+
+    nlohmann::json resources = nlohmann::json::array();
+    for (int i = 0; i < nbImages; i++)
+    {
+        resources.push_back({ { "type", "image" }, { "format", "PNG" }, { "description", "" }, { "file", "image" + std::to_string(i) + ".png" } });
+    }
+    for (int i = 0; i < nbSounds; i++)
+    {
+        resources.push_back({ { "type", "sound" }, { "format", "MP3" }, { "description", "" }, { "file", "sound" + std::to_string(i) + ".mp3" } });
+    }
+    j["resources"] = resources;
+
+    nlohmann::json nodes = nlohmann::json::array();
+    nlohmann::json connections = nlohmann::json::array();
+    std::set<int> targeted;
+    for (int id = 1; id <= nbNodes; id++)
+    {
+        // A node ends the story only if the next one is reached from another
+        // branch: every node is reachable from the first one
+        int kind = percent(rng);
+        int outputs = 1;
+        if ((id == nbNodes) || ((kind < 5) && (targeted.count(id + 1) > 0)))
+        {
+            outputs = 0;
+        }
+        else if (kind < 25)
+        {
+            outputs = 2 + percent(rng) % 3;
+        }
+
+        std::string sound = (percent(rng) < 80) ? "sound" + std::to_string(rng() % nbSounds) + ".mp3" : "";
+        nodes.push_back({ { "id", id },
+                          { "type", "media-node" },
+                          { "outPortCount", outputs },
+                          { "position", { { "x", float(id % 100) * 250.0f }, { "y", float(id / 100) * 200.0f } } },
+                          { "internal-data", { { "image", "image" + std::to_string(rng() % nbImages) + ".png" }, { "sound", sound } } } });
+
+        // Branches go forward, the first one to the next node
+        for (int port = 0; port < outputs; port++)
+        {
+            int target = std::min((port == 0) ? id + 1 : id + 1 + int(rng() % 50), nbNodes);
+            targeted.insert(target);
+            connections.push_back({ { "outNodeId", id }, { "outPortIndex", port },
+                                    { "inNodeId", target }, { "inPortIndex", 0 } });
+        }
+    }
+    j["nodegraph"] = { { "nodes", nodes }, { "connections", connections } };
+
+    return j;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Headless node graph
+// ------------------------------------------------------------------------------------------------
+
+// Media node without the editor: its data and its connections. The code generation
+// is the one of the editor (MediaCode, StoryBuilder).
+class GraphNode : public IBuildNode
+{
+public:
+    GraphNode(const StoryBuilder::Links &outLinks)
+        : m_outLinks(outLinks)
+    {
+    }
+
+    unsigned long id{0};
+    uint32_t outputs{0};
+    float x{0}, y{0};
+    std::string image;
+    std::string sound;
+
+    unsigned long GetId() const override { return id; }
+    std::string GetType() const override { return "media-node"; }
+    uint32_t Outputs() const override { return outputs; }
+    void ToJson(nlohmann::json &j) override { j = { { "image", image }, { "sound", sound } }; }
+    // Same as BaseNode: cached until SetModified()
+    uint64_t DataHash() override
+    {
+        if (!m_hashed)
+        {
+            nlohmann::json j;
+            ToJson(j);
+            m_dataHash = Fnv1a(j.dump());
+            m_hashed = true;
+        }
+        return m_dataHash;
+    }
+    void SetModified() { m_hashed = false; }
+    std::string GetEntryLabel() override { return MediaCode::EntryLabel(id); }
+
+    std::list<std::string> GetAssets() const override
+    {
+        std::list<std::string> assets;
+        for (const auto &f : { image, sound })
+        {
+            if (f.size() > 0)
+            {
+                assets.push_back(f);
+            }
+        }
+        return assets;
+    }
+
+    bool GenerateConstants(Chip32::Assembler &assembler) override { return GetCode().GenerateConstants(assembler); }
+    bool Build(Chip32::Assembler &assembler) override { return GetCode().Build(assembler); }
+
+private:
+    const StoryBuilder::Links &m_outLinks;
+    bool m_hashed{false};
+    uint64_t m_dataHash{0};
+
+    MediaCode GetCode() const
+    {
+        MediaCode code;
+        code.id = id;
+        code.image = image;
+        code.sound = sound;
+        code.outputs = outputs;
+        auto it = m_outLinks.find(id);
+        if (it != m_outLinks.end())
+        {
+            for (const auto &c : it->second)
+            {
+                code.targets.push_back(MediaCode::EntryLabel(c->inNodeId));
+            }
+        }
+        return code;
+    }
+};
+
+class Graph
+{
+public:
+    bool Load(const nlohmann::json &model, std::string &error)
+    {
+        std::set<unsigned long> ids;
+        for (const auto &n : model["nodes"])
+        {
+            auto node = std::make_shared<GraphNode>(m_outLinks);
+            node->id = n["id"].get<int>();
+            node->outputs = n["outPortCount"].get<int>();
+            node->x = n["position"]["x"].get<float>();
+            node->y = n["position"]["y"].get<float>();
+            node->image = n["internal-data"]["image"].get<std::string>();
+            node->sound = n["internal-data"]["sound"].get<std::string>();
+            m_nodes.push_back(node);
+            ids.insert(node->id);
+        }
+
+        for (const auto &c : model["connections"])
+        {
+            auto conn = std::make_shared<Connection>();
+            conn->outNodeId = c["outNodeId"].get<int>();
+            conn->outPortIndex = c["outPortIndex"].get<int>();
+            conn->inNodeId = c["inNodeId"].get<int>();
+            conn->inPortIndex = c["inPortIndex"].get<int>();
+            if ((ids.count(conn->outNodeId) == 0) || (ids.count(conn->inNodeId) == 0))
+            {
+                error = "Connection to an unknown node";
+                return false;
+            }
+            m_links.push_back(conn);
+            m_outLinks[conn->outNodeId].push_back(conn);
+        }
+        return true;
+    }
+
+    // Same as NodeEditorWindow::CopyGraph
+    void Copy(std::vector<StoryProject::NodeData> &nodes, std::vector<StoryProject::LinkData> &links) const
+    {
+        nodes.clear();
+        nodes.reserve(m_nodes.size());
+        for (const auto &n : m_nodes)
+        {
+            nodes.push_back({ n->id, n->GetType(), 1, n->outputs, n->x, n->y, { { "image", n->image }, { "sound", n->sound } } });
+        }
+
+        links.clear();
+        links.reserve(m_links.size());
+        for (const auto &c : m_links)
+        {
+            links.push_back({ c->outNodeId, c->outPortIndex, c->inNodeId, c->inPortIndex });
+        }
+    }
+
+    // Same as NodeEditorWindow::Build
+    bool Build(Chip32::Assembler &assembler, BuildCache &cache)
+    {
+        std::vector<std::shared_ptr<IBuildNode>> nodes(m_nodes.begin(), m_nodes.end());
+        return m_builder.Build(nodes, m_outLinks, assembler, cache);
+    }
+
+    // Small edit, like the user changing the media of one node
+    void TouchNode(size_t index)
+    {
+        auto &node = m_nodes[index % m_nodes.size()];
+        node->sound = "edited.mp3";
+        node->SetModified();
+    }
+
+private:
+    std::vector<std::shared_ptr<GraphNode>> m_nodes;
+    std::list<std::shared_ptr<Connection>> m_links;
+    StoryBuilder::Links m_outLinks;
+    thread_pool m_pool;
+    StoryBuilder m_builder{m_pool};
+};
+
+// ------------------------------------------------------------------------------------------------
+
+static bool Compile(Graph &graph, Chip32::Assembler &assembler, BuildCache &cache, std::string &error)
+{
+    assembler.Clear();
+    bool ok = graph.Build(assembler, cache) &&
+              assembler.Append(".include \"" STORY_SCRIPTS_DIR "/media.asm\"\n") &&
+              assembler.Link();
+    if (!ok)
+    {
+        error = assembler.GetLastError().ToString();
+    }
+    return ok;
+}
+
+static void RunProject(int nbNodes, const std::filesystem::path &libraryDir, nlohmann::json &results)
+{
+    Bench bench(results, nbNodes);
+    std::string uuid = "bench-" + std::to_string(nbNodes);
+
+    StoryProject project;
+    project.New(uuid, libraryDir.string());
+
+    if (!bench.Run("generate", [&](std::string &) {
+            std::ofstream o(std::filesystem::path(project.GetWorkingDir()) / "project.json");
+            o << std::setw(4) << GenerateProject(nbNodes) << std::endl;
+            return o.good();
+        }))
+    {
+        return;
+    }
+
+    nlohmann::json model;
+    ResourceManager resources;
+    Graph graph;
+    Chip32::Assembler assembler;
+    BuildCache cache;
+    std::vector<uint8_t> program;
+    Chip32::Result result;
+    std::string source;
+    StoryProject::Snapshot snapshot;
+
+    bool loaded = bench.Run("project_load", [&](std::string &error) {
+        if (!project.Load(resources) || !project.LoadNodeGraph(model))
+        {
+            error = "Cannot import " + project.GetWorkingDir();
+            return false;
+        }
+        return true;
+    }) &&
+    bench.Run("graph_load", [&](std::string &error) { return graph.Load(model, error); }) &&
+    // Save of the editor: the copy of the project data on the UI thread, the conversion
+    // and the write on a worker thread
+    bench.Run("project_snapshot", [&](std::string &) {
+        snapshot = project.MakeSnapshot(resources);
+        graph.Copy(snapshot.nodes, snapshot.links);
+        return true;
+    }) &&
+    bench.Run("project_write", [&](std::string &error) {
+        return StoryProject::WriteSnapshot(snapshot, error);
+    }) &&
+    bench.Run("journal_100_edits", [&](std::string &) {
+        // Autosave of small edits, replayed by nodegraph_load
+        ProjectJournal journal;
+        journal.Open(project.GetJournalFilePath());
+        journal.Clear();
+        for (int i = 0; i < 100; i++)
+        {
+            nlohmann::json node = model["nodes"][i % model["nodes"].size()];
+            node["position"]["x"] = i;
+            journal.NodeChanged(node);
+        }
+        return journal.Entries() == 100;
+    }) &&
+    bench.Run("project_open", [&](std::string &error) {
+        if (!project.Load(resources))
+        {
+            error = "Cannot load " + project.GetProjectFilePath();
+            return false;
+        }
+        return true;
+    }) &&
+    bench.Run("nodegraph_load", [&](std::string &error) {
+        if (!project.LoadNodeGraph(model))
+        {
+            error = "Cannot load the node graph of " + project.GetProjectFilePath();
+            return false;
+        }
+        return true;
+    }) &&
+    bench.Run("export_json", [&](std::string &) {
+        return project.ExportJson(model, resources, std::filesystem::path(project.GetWorkingDir()) / "export.json");
+    });
+    if (!loaded)
+    {
+        return;
+    }
+
+    if (!bench.Run("build", [&](std::string &error) { return Compile(graph, assembler, cache, error); }))
+    {
+        return;
+    }
+
+    if (bench.Run("build_binary", [&](std::string &error) {
+            if (!assembler.BuildBinary(program, result))
+            {
+                error = assembler.GetLastError().ToString();
+                return false;
+            }
+            return true;
+        }))
+    {
+        results.back()["rom_bytes"] = result.romUsageSize;
+    }
+
+    bench.Run("generate_source", [&](std::string &) {
+        std::stringstream ss;
+        assembler.GenerateSource(ss);
+        source = ss.str();
+        return true;
+    });
+
+    bench.Run("parse_source", [&](std::string &error) {
+        Chip32::Assembler parser;
+        if (!parser.Parse(source))
+        {
+            error = parser.GetLastError().ToString();
+            return false;
+        }
+        return true;
+    });
+
+    graph.TouchNode(nbNodes / 2);
+    bench.Run("rebuild_one_edit", [&](std::string &error) { return Compile(graph, assembler, cache, error); });
+}
+
+// ------------------------------------------------------------------------------------------------
+// Library index
+// ------------------------------------------------------------------------------------------------
+
+// Stories of the index.ost benchmark
+static const int cIndexStories = 10000;
+
+static uint32_t IndexFileRead(void *file, uint8_t *destination, uint32_t size)
+{
+    return std::fread(destination, 1, size, static_cast<FILE *>(file));
+}
+
+// index.ost encoded as LibraryManager::Save() does, decoded in memory and by a stream
+// of small reads like the firmware does
+static void RunIndex(int nbStories, const std::filesystem::path &libraryDir, nlohmann::json &results)
+{
+    Bench bench(results, nbStories);
+    std::filesystem::path fileName = libraryDir / "index.ost";
+    std::vector<uint8_t> data;
+
+    bench.Run("index_encode", [&](std::string &) {
+        uint16_t count = std::min(nbStories, STORY_INDEX_MAX_STORIES);
+        std::vector<uint8_t> index(STORY_INDEX_HEADER_SIZE + count * STORY_INDEX_ENTRY_SIZE);
+        story_index_header_put(index.data(), count);
+
+        uint8_t record[STORY_INDEX_RECORD_MAX];
+        char uuid[40];
+        for (uint16_t i = 0; i < count; i++)
+        {
+            std::snprintf(uuid, sizeof(uuid), "%08x-0000-4000-8000-%012x", i, i);
+            std::string name = "Story " + std::to_string(i);
+            const char *fields[STORY_INDEX_FIELD_COUNT] = { uuid, "title.qoi", "title.wav", name.c_str(),
+                                                            "Synthetic story of the index benchmark" };
+            uint16_t size = story_index_record_put(record, 1, fields);
+            story_index_entry_put(&index[story_index_entry_position(STORY_INDEX_HEADER_SIZE, i)], index.size(), size);
+            index.insert(index.end(), record, record + size);
+        }
+
+        std::filesystem::create_directories(libraryDir);
+        std::ofstream o(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        o.write(reinterpret_cast<const char *>(index.data()), index.size());
+        return o.good();
+    }) &&
+    bench.Run("index_decode", [&](std::string &error) {
+        std::ifstream f(fileName, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+        uint16_t count = 0;
+        uint32_t table = 0;
+        if ((data.size() < STORY_INDEX_HEADER_SIZE) || !story_index_header_get(data.data(), &count, &table))
+        {
+            error = "Invalid index header";
+            return false;
+        }
+
+        size_t valid = 0;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint32_t offset;
+            uint16_t size;
+            story_index_record_t record;
+            story_index_entry_get(&data[story_index_entry_position(table, i)], &offset, &size);
+            if (story_index_record_get(&data[offset], size, &record) && (record.lengths[STORY_INDEX_FIELD_UUID] == 36))
+            {
+                valid++;
+            }
+        }
+        if (valid != count)
+        {
+            error = std::to_string(count - valid) + " invalid records";
+        }
+        return valid == count;
+    }) &&
+    bench.Run("index_stream_decode", [&](std::string &error) {
+        // Firmware: table entry from memory, one seek and a stream of the first fields
+        FILE *f = std::fopen(fileName.string().c_str(), "rb");
+        if (f == nullptr)
+        {
+            error = "Cannot open " + fileName.string();
+            return false;
+        }
+
+        uint16_t count = 0;
+        uint32_t table = 0;
+        story_index_header_get(data.data(), &count, &table);
+
+        size_t valid = 0;
+        uint8_t window[TLV_HEADER_SIZE + STORY_INDEX_STRING_MAX];
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint32_t offset;
+            uint16_t size;
+            story_index_entry_get(&data[story_index_entry_position(table, i)], &offset, &size);
+            std::fseek(f, offset, SEEK_SET);
+
+            tlv_stream_t stream;
+            tlv_item_t item;
+            tlv_stream_init(&stream, IndexFileRead, f, window, sizeof(window));
+            bool ok = tlv_stream_read(&stream, &item) && (item.type == TLV_OBJECT_TYPE);
+            for (int field = 0; ok && (field <= STORY_INDEX_FIELD_TITLE_SOUND); field++)
+            {
+                ok = tlv_stream_read(&stream, &item) && (item.type == TLV_STRING_TYPE);
+            }
+            valid += ok ? 1 : 0;
+        }
+        std::fclose(f);
+
+        if (valid != count)
+        {
+            error = std::to_string(count - valid) + " invalid records";
+        }
+        return valid == count;
+    });
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    std::string outFile = "story_bench.json";
+    bool keep = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--out") && (i + 1 < argc))
+        {
+            outFile = argv[++i];
+        }
+        else if (arg == "--keep")
+        {
+            keep = true;
+        }
+        else
+        {
+            sizes.push_back(std::stoi(arg));
+        }
+    }
+    if (sizes.empty())
+    {
+        sizes = { 1000, 10000, 100000 };
+    }
+
+    std::filesystem::path libraryDir = std::filesystem::temp_directory_path() / "story_bench";
+    nlohmann::json results = nlohmann::json::array();
+
+    for (int n : sizes)
+    {
+        RunProject(n, libraryDir, results);
+    }
+    RunIndex(cIndexStories, libraryDir, results);
+
+    if (!keep)
+    {
+        std::filesystem::remove_all(libraryDir);
+    }
+
+    std::ofstream o(outFile);
+    o << std::setw(4) << results << std::endl;
+    std::cerr << "Results written to " << outFile << std::endl;
+
+    return 0;
+}
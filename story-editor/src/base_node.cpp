@@ -1,5 +1,6 @@
 #include "base_node.h"
 #include "uuid.h"
+#include "fnv1a.h"
 
 #include "IconsMaterialDesignIcons.h"
 
@@ -63,13 +64,51 @@ void BaseNode::FrameStart()
         ed::SetNodePosition(m_node->ID, ImVec2(m_pos.x, m_pos.y));
     }
     m_firstFrame = false;
+
+    ImGui::BeginGroup();
 }
 
 void BaseNode::FrameEnd()
 {
+    ImGui::EndGroup();
+    m_boundsMin = ImGui::GetItemRectMin();
+    m_boundsMax = ImGui::GetItemRectMax();
+
     ed::EndNode();
 }
 
+void BaseNode::DrawPlaceholder()
+{
+    static const ImVec2 size(320, 240); // Same footprint as the media node image
+
+    FrameStart();
+
+    ImGui::TextUnformatted(m_type.c_str());
+    ImVec2 p = ImGui::GetCursorScreenPos();
+    ImGui::GetWindowDrawList()->AddRectFilled(p, ImVec2(p.x + size.x, p.y + size.y), ImGui::GetColorU32(ImVec4(0.3f, 0.3f, 0.7f, 1.0f)));
+    ImGui::Dummy(size);
+
+    DrawPins();
+
+    FrameEnd();
+}
+
+bool BaseNode::IsVisible(const ImVec2 &viewMin, const ImVec2 &viewMax) const
+{
+    static const float margin = 32.0f; // node padding and pins outside of the content
+
+    // Never drawn, or moved since: start at the stored position, with a typical size if unknown
+    ImVec2 min = m_firstFrame ? ImVec2(m_pos.x, m_pos.y) : m_boundsMin;
+    ImVec2 size(m_boundsMax.x - m_boundsMin.x, m_boundsMax.y - m_boundsMin.y);
+    if ((size.x <= 0) || (size.y <= 0))
+    {
+        size = ImVec2(400, 400);
+    }
+
+    return (min.x - margin < viewMax.x) && (min.x + size.x + margin > viewMin.x) &&
+           (min.y - margin < viewMax.y) && (min.y + size.y + margin > viewMin.y);
+}
+
 void BaseNode::DrawPins()
 {
     static const char *str = "#1 >";
@@ -94,14 +133,36 @@ void BaseNode::DrawPins()
     }
 }
 
+uint64_t BaseNode::DataHash()
+{
+    // The data is changed by the user edits (SetModified()) or by the load, on a new node
+    if (!m_hashed)
+    {
+        nlohmann::json j;
+        ToJson(j);
+        m_dataHash = Fnv1a(j.dump());
+        m_hashed = true;
+    }
+    return m_dataHash;
+}
+
 float BaseNode::GetX() const
 {
+    // Not drawn yet (off-screen nodes), the editor does not know the node
+    if (m_firstFrame)
+    {
+        return m_pos.x;
+    }
     auto pos = GetNodePosition(m_node->ID);
     return pos.x;
 }
 
 float BaseNode::GetY() const
 {
+    if (m_firstFrame)
+    {
+        return m_pos.y;
+    }
     auto pos = GetNodePosition(m_node->ID);
     return pos.y;
 }
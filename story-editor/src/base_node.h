@@ -8,6 +8,8 @@
 
 #include "json.hpp"
 #include "i_story_manager.h"
+#include "chip32_assembler.h"
+#include "story_builder.h"
 
 #include <imgui_node_editor.h>
 namespace ed = ax::NodeEditor;
@@ -92,7 +94,7 @@ struct Link
 };
 
 
-class BaseNode
+class BaseNode : public IBuildNode
 {
 public:
     struct NodePosition
@@ -105,43 +107,53 @@ public:
 
 
     virtual void Draw() = 0;
+    // Cheap version of the node: title, colored box and pins, for far zoom and off-screen nodes
+    virtual void DrawPlaceholder();
     virtual void DrawProperties() = 0;
-    virtual std::string GenerateConstants() = 0;
-    virtual std::string Build() = 0;
-    virtual std::string GetEntryLabel() = 0;
+    virtual std::list<std::string> GetAssets() const override { return {}; }
 
     void SetPosition(float x, float y);
 
+    // User edit of the node data, taken by the editor to record it in the project journal
+    void SetModified() { m_modified = true; m_hashed = false; }
+    bool TakeModified() { bool modified = m_modified; m_modified = false; return modified; }
+
     void FrameStart();
     void FrameEnd();
 
     void DrawPins();
 
+    // Bounds in canvas coordinates are the ones of the last drawn frame
+    bool IsVisible(const ImVec2 &viewMin, const ImVec2 &viewMax) const;
+
     float GetX() const;
     float GetY() const;
 
     uint32_t Inputs() const { return m_node->Inputs.size(); }
-    uint32_t Outputs() const { return m_node->Outputs.size(); }
+    uint32_t Outputs() const override { return m_node->Outputs.size(); }
 
     void SetType(const std::string &type)
     {
         m_type = type;
     }
 
-    std::string GetType() const
+    std::string GetType() const override
     {
         return m_type;
     }
 
     void SetId(unsigned long id) { m_id = id; }
-    unsigned long GetId() const { return m_id; }
+    unsigned long GetId() const override { return m_id; }
     unsigned long GetInternalId() const { return m_node->ID.Get(); }
 
     void SeTitle(const std::string &title) { m_title = title; }
     std::string GetTitle() const { return m_title; }
 
     virtual void FromJson(const nlohmann::json &) = 0;
-    virtual void ToJson(nlohmann::json &) = 0;
+    using IBuildNode::ToJson;
+    // Same fields as ToJson(), as text: copied by the UI thread when the project is saved
+    virtual void GetData(std::vector<std::pair<std::string, std::string>> &data) const = 0;
+    uint64_t DataHash() override;
 
     virtual nlohmann::json ToJson() const {
         nlohmann::json j;
@@ -232,6 +244,11 @@ private:
     unsigned long m_id;
     NodePosition m_pos;
     bool m_firstFrame{true};
+    bool m_modified{false};
+    bool m_hashed{false};
+    uint64_t m_dataHash{0};
+    ImVec2 m_boundsMin{0, 0};
+    ImVec2 m_boundsMax{0, 0};
 
     static unsigned long s_nextId;
 
@@ -0,0 +1,212 @@
+#include "build_cache.h"
+
+#include <fstream>
+#include <iostream>
+#include "json.hpp"
+#include "fnv1a.h"
+
+static const int cCacheVersion = 1;
+
+static nlohmann::json StatementsToJson(const std::vector<Chip32::Statement> &statements)
+{
+    nlohmann::json array = nlohmann::json::array();
+    for (const auto &s : statements)
+    {
+        nlohmann::json args = nlohmann::json::array();
+        for (const auto &a : s.args)
+        {
+            args.push_back({ a.type, a.value, a.text });
+        }
+        array.push_back({ s.type, s.label, s.op, s.typeSize, s.count, args });
+    }
+    return array;
+}
+
+static std::vector<Chip32::Statement> StatementsFromJson(const nlohmann::json &array)
+{
+    std::vector<Chip32::Statement> statements;
+    for (const auto &j : array)
+    {
+        Chip32::Statement s;
+        s.type = j[0].get<Chip32::Statement::Type>();
+        s.label = j[1].get<std::string>();
+        s.op = j[2].get<chip32_instruction_t>();
+        s.typeSize = j[3].get<uint16_t>();
+        s.count = j[4].get<uint16_t>();
+        for (const auto &a : j[5])
+        {
+            s.args.push_back({ a[0].get<Chip32::Operand::Type>(), a[1].get<uint32_t>(), a[2].get<std::string>() });
+        }
+        statements.push_back(s);
+    }
+    return statements;
+}
+
+void BuildCache::Load(const std::string &workingDir)
+{
+    std::filesystem::path fileName = std::filesystem::path(workingDir) / "build_cache.json";
+    if (fileName == m_fileName)
+    {
+        return;
+    }
+
+    Clear();
+    m_fileName = fileName;
+
+    std::ifstream f(m_fileName);
+    if (!f.is_open())
+    {
+        return;
+    }
+
+    try
+    {
+        nlohmann::json j = nlohmann::json::parse(f);
+        if (j["version"].get<int>() != cCacheVersion)
+        {
+            return;
+        }
+
+        for (const auto &n : j["nodes"].items())
+        {
+            auto fragment = std::make_shared<Fragment>();
+            fragment->hash = n.value()["hash"].get<uint64_t>();
+            fragment->constants = StatementsFromJson(n.value()["constants"]);
+            fragment->code = StatementsFromJson(n.value()["code"]);
+            m_fragments[std::stoul(n.key())].fragment = fragment;
+        }
+
+        for (const auto &a : j["assets"].items())
+        {
+            Asset asset;
+            asset.output = a.value()["output"].get<std::string>();
+            asset.size = a.value()["size"].get<uint64_t>();
+            asset.mtime = a.value()["mtime"].get<int64_t>();
+            m_assets[a.key()] = asset;
+        }
+    }
+    catch (std::exception &e)
+    {
+        // A bad cache is only a slower build
+        std::cout << "Build cache ignored: " << e.what() << std::endl;
+        m_fragments.clear();
+        m_assets.clear();
+    }
+}
+
+void BuildCache::Save()
+{
+    if (m_fileName.empty())
+    {
+        return;
+    }
+
+    nlohmann::json j;
+    j["version"] = cCacheVersion;
+
+    nlohmann::json nodes = nlohmann::json::object();
+    for (const auto &f : m_fragments)
+    {
+        nodes[std::to_string(f.first)] = {
+            { "hash", f.second.fragment->hash },
+            { "constants", StatementsToJson(f.second.fragment->constants) },
+            { "code", StatementsToJson(f.second.fragment->code) }
+        };
+    }
+    j["nodes"] = nodes;
+
+    nlohmann::json assets = nlohmann::json::object();
+    for (const auto &a : m_assets)
+    {
+        assets[a.first] = { { "output", a.second.output }, { "size", a.second.size }, { "mtime", a.second.mtime } };
+    }
+    j["assets"] = assets;
+
+    std::ofstream o(m_fileName);
+    o << j;
+}
+
+void BuildCache::Clear()
+{
+    m_fileName.clear();
+    m_fragments.clear();
+    m_assets.clear();
+}
+
+void BuildCache::BeginBuild()
+{
+    for (auto &f : m_fragments)
+    {
+        f.second.used = false;
+    }
+}
+
+std::shared_ptr<const BuildCache::Fragment> BuildCache::FindFragment(unsigned long nodeId, uint64_t hash)
+{
+    auto it = m_fragments.find(nodeId);
+    if ((it != m_fragments.end()) && (it->second.fragment->hash == hash))
+    {
+        it->second.used = true;
+        return it->second.fragment;
+    }
+    return nullptr;
+}
+
+void BuildCache::StoreFragment(unsigned long nodeId, std::shared_ptr<const Fragment> fragment)
+{
+    m_fragments[nodeId] = { std::move(fragment), true };
+}
+
+void BuildCache::EndBuild()
+{
+    // Deleted nodes
+    for (auto it = m_fragments.begin(); it != m_fragments.end();)
+    {
+        if (!it->second.used) {
+            it = m_fragments.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool BuildCache::IsConverted(const std::string &inputFile, const std::string &outputFile)
+{
+    Asset current;
+    auto it = m_assets.find(inputFile);
+
+    return (it != m_assets.end()) &&
+           GetFileInfo(inputFile, current) &&
+           (it->second.output == outputFile) &&
+           (it->second.size == current.size) &&
+           (it->second.mtime == current.mtime) &&
+           std::filesystem::exists(outputFile);
+}
+
+void BuildCache::SetConverted(const std::string &inputFile, const std::string &outputFile)
+{
+    Asset asset;
+    if (GetFileInfo(inputFile, asset))
+    {
+        asset.output = outputFile;
+        m_assets[inputFile] = asset;
+    }
+}
+
+uint64_t BuildCache::Hash(const std::string &data)
+{
+    // The target format (and its terminating zero as a separator) is part of the key: the outputs change with it
+    return Fnv1a(data, Fnv1a(cTargetFormat.data(), cTargetFormat.size() + 1));
+}
+
+bool BuildCache::GetFileInfo(const std::string &fileName, Asset &info)
+{
+    std::error_code ec;
+    info.size = std::filesystem::file_size(fileName, ec);
+    if (ec)
+    {
+        return false;
+    }
+    info.mtime = std::filesystem::last_write_time(fileName, ec).time_since_epoch().count();
+    return !ec;
+}
@@ -0,0 +1,66 @@
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <filesystem>
+
+#include "chip32_assembler.h"
+
+// Incremental build: instructions of the unchanged nodes and converted assets
+// are reused from the previous builds. Stored in the project working directory.
+class BuildCache
+{
+public:
+    // Output formats of the assets, part of every hash (FIXME: user option)
+    static inline const std::string cTargetFormat = "qoi;wav";
+
+    struct Fragment {
+        uint64_t hash{0}; //!< hash of the node data, connections and target format
+        std::vector<Chip32::Statement> constants;
+        std::vector<Chip32::Statement> code;
+    };
+
+    // Does nothing if the cache of this directory is already loaded
+    void Load(const std::string &workingDir);
+    void Save();
+    void Clear();
+
+    // Node fragments, the ones not used since BeginBuild() are dropped by EndBuild().
+    // They are shared with the builds, not copied.
+    void BeginBuild();
+    std::shared_ptr<const Fragment> FindFragment(unsigned long nodeId, uint64_t hash);
+    void StoreFragment(unsigned long nodeId, std::shared_ptr<const Fragment> fragment);
+    void EndBuild();
+
+    // The conversion of an asset can be skipped if the source file did not change since the last one
+    bool IsConverted(const std::string &inputFile, const std::string &outputFile);
+    void SetConverted(const std::string &inputFile, const std::string &outputFile);
+
+    static uint64_t Hash(const std::string &data);
+
+private:
+    struct Asset {
+        std::string output;
+        uint64_t size{0};
+        int64_t mtime{0};
+    };
+
+    std::filesystem::path m_fileName;
+    struct Entry {
+        std::shared_ptr<const Fragment> fragment;
+        bool used{false}; //!< since BeginBuild()
+    };
+
+    std::unordered_map<unsigned long, Entry> m_fragments; // key: node Id
+    std::map<std::string, Asset> m_assets;
+
+    static bool GetFileInfo(const std::string &fileName, Asset &info);
+};
+
+#endif // BUILD_CACHE_H
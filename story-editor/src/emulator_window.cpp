@@ -36,7 +36,7 @@ void EmulatorWindow::Draw()
 
     if (m_image.Valid())
     {
-        ImGui::Image(m_image.texture, ImVec2(320, 240));
+        ImGui::Image(m_image.GetTexture(), ImVec2(320, 240), m_image.GetUv0(), m_image.GetUv1());
     }
     else
     {
@@ -9,6 +9,18 @@ your use of the corresponding standard functions.
 
 #include <stdio.h>
 #include <iostream>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <fstream>
 
 #include "imgui_impl_sdl2.h"
 #include "imgui_impl_sdlrenderer2.h"
@@ -23,6 +35,10 @@ your use of the corresponding standard functions.
 #include "IconsMaterialDesignIcons.h"
 #include "IconsFontAwesome5_c.h"
 #include "qoi.h"
+#include "thread_pool.hpp"
+#include "thread_safe_queue.h"
+#include "media_converter.h"
+#include "fnv1a.h"
 
 
 #include "platform_folders.h"
@@ -46,71 +62,504 @@ static std::string GetFileExtension(const std::string &fileName)
 }
 
 
-// Simple helper function to load an image into a OpenGL texture with common settings
-bool LoadTextureFromFile(const char* filename, Gui::Image &img)
+struct AtlasPage;
+
+struct Gui::Texture
+{
+    SDL_Texture *texture{nullptr}; // Created on the main thread when the file is decoded
+    int w{0};
+    int h{0};
+    bool failed{false};
+
+    // Part of the texture used by the image, the whole texture unless it is in an atlas page
+    ImVec2 uv0{0, 0};
+    ImVec2 uv1{1, 1};
+    AtlasPage *page{nullptr};
+    int slot{-1};
+
+    ~Texture();
+};
+
+// Pixels of an image file, decoded by a worker thread
+struct DecodedImage
 {
+    std::shared_ptr<Gui::Texture> texture;
+    std::string fileName;
+    bool thumbnail{false};
+    void *pixels{nullptr};
+    int w{0};
+    int h{0};
+    int channels{0};
+
+    ~DecodedImage() {
+        // Both decoders allocate with malloc()
+        free(pixels);
+    }
+};
 
+// QOI or any format of stb_image, thread safe
+static void DecodeImage(DecodedImage &image)
+{
+    if (GetFileExtension(image.fileName) == "qoi")
+    {
+        qoi_desc desc;
+        image.pixels = qoi_read(image.fileName.c_str(), &desc, 0);
+        image.channels = desc.channels;
+        image.w = desc.width;
+        image.h = desc.height;
+    }
+    else
+    {
+        image.pixels = stbi_load(image.fileName.c_str(), &image.w, &image.h, &image.channels, 0);
+    }
+}
 
-    std::string ext = GetFileExtension(filename);
+// A page is a big texture divided in slots of one thumbnail size
+struct AtlasPage
+{
+    SDL_Texture *texture{nullptr};
+    int slotW{0};
+    int slotH{0};
+    std::vector<int> freeSlots;
+};
+
+// Thumbnails are packed in a few big textures: the images of one page are drawn
+// without texture switch, ImGui merges them in one draw call. Main thread only.
+class TextureAtlas
+{
+public:
+    bool Add(const DecodedImage &image, Gui::Texture &tex)
+    {
+        // Smallest thumbnail size that fits, RGBA only
+        int i = 0;
+        while ((i < cSizes) && ((image.w > cSlotWidths[i]) || (image.h > cSlotWidths[i] * 3 / 4)))
+        {
+            i++;
+        }
+        if ((i == cSizes) || (image.channels != 4))
+        {
+            return false;
+        }
 
-    SDL_Surface* surface = nullptr;
+        AtlasPage *page = FindPage(cSlotWidths[i], cSlotWidths[i] * 3 / 4);
+        if (page == nullptr)
+        {
+            return false;
+        }
 
-    if (ext == "qoi")
-    {
-        qoi_desc desc;
-        void *pixels = qoi_read(filename, &desc, 0);
-        unsigned int channels = desc.channels;
-        img.w = desc.width;
-        img.h = desc.height;
+        int slot = page->freeSlots.back();
+        int columns = cPageSize / (page->slotW + cPadding);
+        SDL_Rect rect;
+        rect.x = (slot % columns) * (page->slotW + cPadding) + cPadding / 2;
+        rect.y = (slot / columns) * (page->slotH + cPadding) + cPadding / 2;
+        rect.w = image.w;
+        rect.h = image.h;
 
-        surface = SDL_CreateRGBSurfaceFrom((void*)pixels, img.w, img.h, channels * 8, channels * img.w,
-                                           0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+        if (SDL_UpdateTexture(page->texture, &rect, image.pixels, image.w * 4) != 0)
+        {
+            return false;
+        }
+        page->freeSlots.pop_back();
+
+        tex.texture = page->texture;
+        tex.w = image.w;
+        tex.h = image.h;
+        tex.uv0 = ImVec2(float(rect.x) / cPageSize, float(rect.y) / cPageSize);
+        tex.uv1 = ImVec2(float(rect.x + rect.w) / cPageSize, float(rect.y + rect.h) / cPageSize);
+        tex.page = page;
+        tex.slot = slot;
+        return true;
+    }
 
-        if (pixels != NULL)
+    void Release(Gui::Texture &tex)
+    {
+        tex.page->freeSlots.push_back(tex.slot);
+    }
+
+    // Before the renderer is destroyed, the pages stay for the release of the remaining slots
+    void Clear()
+    {
+        for (auto &p : m_pages)
         {
-            free(pixels);
+            if (p->texture != nullptr)
+            {
+                SDL_DestroyTexture(p->texture);
+                p->texture = nullptr;
+            }
         }
     }
-    else
+
+private:
+    static const int cPageSize = 2048;
+    static const int cPadding = 2; // No filtering with the neighbor slots
+    static const int cSizes = 3;
+    static constexpr int cSlotWidths[cSizes] = { 80, 160, 320 }; // 4:3 thumbnails
+
+    std::vector<std::unique_ptr<AtlasPage>> m_pages;
+
+    AtlasPage *FindPage(int slotW, int slotH)
     {
-        unsigned char* data = nullptr;
-        int channels;
-        data = stbi_load(filename, &img.w, &img.h, &channels, 0);
+        for (auto &p : m_pages)
+        {
+            if ((p->slotW == slotW) && (p->texture != nullptr) && !p->freeSlots.empty())
+            {
+                return p.get();
+            }
+        }
 
-        if (data == nullptr) {
-            fprintf(stderr, "Failed to load image: %s\n", stbi_failure_reason());
-            return false;
+        auto page = std::make_unique<AtlasPage>();
+        page->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STATIC, cPageSize, cPageSize);
+        if (page->texture == nullptr)
+        {
+            fprintf(stderr, "Failed to create SDL texture: %s\n", SDL_GetError());
+            return nullptr;
         }
+        SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+        page->slotW = slotW;
+        page->slotH = slotH;
 
+        int count = (cPageSize / (slotW + cPadding)) * (cPageSize / (slotH + cPadding));
+        for (int i = count - 1; i >= 0; i--)
+        {
+            page->freeSlots.push_back(i);
+        }
+        m_pages.push_back(std::move(page));
+        return m_pages.back().get();
+    }
+};
 
-        // SDL3
-        //    SDL_Surface* surface = SDL_CreateSurfaceFrom((void*)data, img.w, img.h, 4 * img.w, SDL_PIXELFORMAT_RGBA8888);
+static TextureAtlas textureAtlas;
 
-        // SDL2
-        surface = SDL_CreateRGBSurfaceFrom((void*)data, img.w, img.h, channels * 8, channels * img.w,
-                                           0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
-        stbi_image_free(data);
+Gui::Texture::~Texture()
+{
+    if (page != nullptr)
+    {
+        textureAtlas.Release(*this);
     }
+    else if (texture != nullptr)
+    {
+        SDL_DestroyTexture(texture);
+    }
+}
 
+static bool CreateTexture(const DecodedImage &image, Gui::Texture &tex)
+{
+    if (image.pixels == nullptr) {
+        fprintf(stderr, "Failed to load image: %s\n", image.fileName.c_str());
+        return false;
+    }
+
+    if (image.thumbnail && textureAtlas.Add(image, tex))
+    {
+        return true;
+    }
+
+    // SDL3
+    //    SDL_Surface* surface = SDL_CreateSurfaceFrom((void*)data, img.w, img.h, 4 * img.w, SDL_PIXELFORMAT_RGBA8888);
+
+    // SDL2, the surface uses the pixels until the texture is created
+    SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(image.pixels, image.w, image.h, image.channels * 8, image.channels * image.w,
+                                                    0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
 
     if (surface == nullptr) {
         fprintf(stderr, "Failed to create SDL surface: %s\n", SDL_GetError());
         return false;
     }
 
-    img.texture = SDL_CreateTextureFromSurface(renderer, surface);
+    tex.texture = SDL_CreateTextureFromSurface(renderer, surface);
+    tex.w = image.w;
+    tex.h = image.h;
+
+    //    SDL_DestroySurface(surface); // SDL3
+    SDL_FreeSurface(surface); // SDL2
 
-    if (img.texture == nullptr) {
+    if (tex.texture == nullptr) {
         fprintf(stderr, "Failed to create SDL texture: %s\n", SDL_GetError());
+        return false;
     }
+    return true;
+}
 
-//    SDL_DestroySurface(surface); // SDL3
-    SDL_FreeSurface(surface); // SDL2
+static std::string thumbnailDirectory = (std::filesystem::temp_directory_path() / "story-editor-thumbnails").string();
 
+// Content hash of the source images, so that an existing thumbnail is found without reading its
+// source. One line per source file, "hash<TAB>path|size|date", appended when a source is hashed:
+// a source with another size or date is hashed again, the last line of a source wins.
+class ThumbnailManifest
+{
+public:
+    // False if the source is unknown, or changed since it was hashed
+    bool Find(const std::string &directory, const std::string &source, uint64_t &hash)
+    {
+        std::scoped_lock<std::mutex> lock(m_mutex);
+        Load(directory);
+        auto it = m_hashes.find(source);
+        if (it == m_hashes.end())
+        {
+            return false;
+        }
+        hash = it->second;
+        return true;
+    }
 
-    return true;
+    void Add(const std::string &directory, const std::string &source, uint64_t hash)
+    {
+        std::scoped_lock<std::mutex> lock(m_mutex);
+        Load(directory);
+        m_hashes[source] = hash;
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        std::ofstream f(std::filesystem::path(directory) / cFileName, std::ios::app);
+        f << Line(source, hash);
+    }
+
+private:
+    static inline const char *cFileName = "manifest.txt";
+    static const size_t cHashSize = 16; // hexadecimal digits
+
+    std::mutex m_mutex;
+    std::string m_directory; // of the loaded manifest
+    std::unordered_map<std::string, uint64_t> m_hashes; // key: source file identity
+
+    static std::string Line(const std::string &source, uint64_t hash)
+    {
+        std::stringstream line;
+        line << std::hex << std::setw(cHashSize) << std::setfill('0') << hash << '\t' << source << '\n';
+        return line.str();
+    }
+
+    void Load(const std::string &directory)
+    {
+        if (directory == m_directory)
+        {
+            return;
+        }
+        m_directory = directory;
+        m_hashes.clear();
+
+        std::filesystem::path fileName = std::filesystem::path(directory) / cFileName;
+        std::ifstream f(fileName);
+        std::string line;
+        size_t lines = 0;
+        while (std::getline(f, line))
+        {
+            if ((line.size() <= cHashSize + 1) || (line[cHashSize] != '\t'))
+            {
+                continue; // Write interrupted
+            }
+            m_hashes[line.substr(cHashSize + 1)] = std::strtoull(line.substr(0, cHashSize).c_str(), nullptr, 16);
+            lines++;
+        }
+        f.close();
+
+        // Lines of the replaced sources accumulate, the file is rewritten when they are the most
+        if (lines > 2 * m_hashes.size() + 100)
+        {
+            std::filesystem::path temp = fileName;
+            temp += ".tmp";
+            std::ofstream o(temp, std::ios::trunc);
+            for (const auto &h : m_hashes)
+            {
+                o << Line(h.first, h.second);
+            }
+            o.close();
+
+            std::error_code ec;
+            if (o.good())
+            {
+                std::filesystem::rename(temp, fileName, ec);
+            }
+            else
+            {
+                std::filesystem::remove(temp, ec);
+            }
+        }
+    }
+};
+
+static ThumbnailManifest thumbnailManifest;
+
+// Thumbnails are generated once, their name is the hash of the source file content and of the
+// thumbnail size: a file replaced with the same size and date (copy keeping the dates, coarse
+// file system clock) gets a new thumbnail. The source is only read when it is not in the
+// manifest (new or changed file). Runs on a worker thread, returns the file to decode.
+// source: identity of the file (path, size, date)
+static std::string GetThumbnail(const std::string &fileName, const std::string &source, const std::string &directory, int width, int height)
+{
+    uint64_t content;
+    if (!thumbnailManifest.Find(directory, source, content))
+    {
+        std::ifstream f(fileName, std::ios::binary);
+        if (!f)
+        {
+            return fileName;
+        }
+        content = Fnv1a(std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>()));
+        thumbnailManifest.Add(directory, source, content);
+    }
+    uint64_t hash = Fnv1a(std::to_string(width) + "x" + std::to_string(height), content);
+
+    std::stringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << ".qoi";
+    std::filesystem::path thumbnail = std::filesystem::path(directory) / name.str();
+
+    std::error_code ec;
+    if (!std::filesystem::exists(thumbnail, ec))
+    {
+        // Written next to its final name then renamed, a thumbnail is always complete
+        std::filesystem::create_directories(directory, ec);
+        std::filesystem::path temp = thumbnail;
+        temp += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+        if (MediaConverter::ImageToThumbnail(fileName, temp.string(), width, height) != MediaConverter::cSuccess)
+        {
+            std::filesystem::remove(temp, ec);
+            return fileName;
+        }
+        std::filesystem::rename(temp, thumbnail, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp, ec);
+            return fileName;
+        }
+    }
+    return thumbnail.string();
 }
 
+// Textures are shared by all the images of the same file, the key is the absolute
+// path, the modification time and the thumbnail size. The unused ones are kept for a next use, the least
+// recently used are destroyed when the cache is over its memory budget.
+//
+// Files are decoded by worker threads. The textures are created on the main thread
+// at the start of the frames, within a time budget, so the GUI does not freeze.
+class TextureCache
+{
+public:
+    // Size of 0: the full image
+    std::shared_ptr<Gui::Texture> Get(const std::string &filename, int width, int height)
+    {
+        std::error_code ec;
+        std::filesystem::path path = std::filesystem::absolute(filename, ec);
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec)
+        {
+            fprintf(stderr, "Failed to load image: %s\n", filename.c_str());
+            return nullptr;
+        }
+        std::string source = path.generic_string() + "|" + std::to_string(size) + "|" + std::to_string(mtime.time_since_epoch().count());
+        std::string key = source + "|" + std::to_string(width) + "x" + std::to_string(height);
+
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return it->second->texture;
+        }
+
+        auto texture = std::make_shared<Gui::Texture>();
+        auto decoded = std::make_shared<DecodedImage>();
+        decoded->texture = texture;
+        decoded->fileName = path.string();
+
+        std::string directory = thumbnailDirectory;
+        decoded->thumbnail = (width > 0);
+
+        // The task gives its reference to the queue: the texture is always destroyed by the main thread
+        m_pool.push_task([this, decoded, source, directory, width, height]() mutable {
+            if (width > 0)
+            {
+                decoded->fileName = GetThumbnail(decoded->fileName, source, directory, width, height);
+            }
+            DecodeImage(*decoded);
+            m_decoded.push(std::move(decoded));
+        });
+
+        m_lru.push_front({ key, texture });
+        m_index[key] = m_lru.begin();
+
+        return texture;
+    }
+
+    // Main thread, at least one texture per frame
+    void Upload(double budgetMs)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<DecodedImage> decoded;
+
+        while (m_decoded.try_pop(decoded))
+        {
+            if (CreateTexture(*decoded, *decoded->texture))
+            {
+                m_size += Size(*decoded->texture);
+            }
+            else
+            {
+                decoded->texture->failed = true;
+            }
+            decoded.reset();
+
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() > budgetMs)
+            {
+                break;
+            }
+        }
+        Trim();
+    }
+
+    // Before the renderer is destroyed
+    void Clear()
+    {
+        m_pool.wait_for_tasks();
+
+        std::shared_ptr<DecodedImage> decoded;
+        while (m_decoded.try_pop(decoded))
+        {
+            decoded.reset();
+        }
+
+        m_index.clear();
+        m_lru.clear();
+        m_size = 0;
+    }
+
+private:
+    static const size_t cBudget = 256 * 1024 * 1024; // bytes
+
+    struct Entry {
+        std::string key;
+        std::shared_ptr<Gui::Texture> texture;
+    };
+
+    std::list<Entry> m_lru; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+    size_t m_size{0};
+
+    ThreadSafeQueue<std::shared_ptr<DecodedImage>> m_decoded;
+    thread_pool m_pool{ std::max(1u, std::thread::hardware_concurrency() / 2) }; // Destroyed first, its tasks use the queue
+
+    static size_t Size(const Gui::Texture &texture) { return size_t(texture.w) * texture.h * 4; }
+
+    void Trim()
+    {
+        // Textures still used by an image, or not decoded yet, are not counted as free memory
+        auto it = m_lru.end();
+        while ((m_size > cBudget) && (it != m_lru.begin()))
+        {
+            --it;
+            if ((it->texture.use_count() == 1) && (it->texture->texture != nullptr))
+            {
+                m_size -= Size(*it->texture);
+                m_index.erase(it->key);
+                it = m_lru.erase(it);
+            }
+        }
+    }
+};
+
+static TextureCache textureCache;
+
 #define MANOLAB_VERSION "1.0"
 
 std::string GetDirectory (const std::string& path)
@@ -268,6 +717,9 @@ void Gui::StartFrame()
     ImGui_ImplSDLRenderer2_NewFrame();
     ImGui_ImplSDL2_NewFrame();
 
+    // Textures of the images decoded since the last frame
+    textureCache.Upload(4.0);
+
     ImGui::NewFrame();
 }
 
@@ -304,6 +756,8 @@ void Gui::Destroy()
 
     ImGui::DestroyContext();
 
+    textureCache.Clear();
+    textureAtlas.Clear();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -318,7 +772,12 @@ bool Gui::LoadRawImage(const std::string &filename, Image &image)
 {
     bool success = true;
 
-    LoadTextureFromFile(filename.c_str(), image);
+    image.Clear();
+    image.shared = textureCache.Get(filename, 0, 0);
+    if (!image.shared)
+    {
+        success = false;
+    }
 
     return success;
 }
@@ -536,23 +995,53 @@ void LoadingIndicatorCircle(const char* label, const float indicator_radius,
 
 void Gui::Image::Clear()
 {
-    if (texture != nullptr)
-    {
-        SDL_DestroyTexture(static_cast<SDL_Texture*>(texture));
-    }
+    // The texture is destroyed by the cache
+    shared.reset();
+}
+
+bool Gui::Image::Valid() const
+{
+    return shared && (shared->texture != nullptr);
+}
+
+bool Gui::Image::IsLoading() const
+{
+    return shared && (shared->texture == nullptr) && !shared->failed;
+}
+
+void *Gui::Image::GetTexture() const
+{
+    return Valid() ? shared->texture : nullptr;
+}
+
+ImVec2 Gui::Image::GetUv0() const
+{
+    return Valid() ? shared->uv0 : ImVec2(0, 0);
+}
+
+ImVec2 Gui::Image::GetUv1() const
+{
+    return Valid() ? shared->uv1 : ImVec2(1, 1);
 }
 
 void Gui::Image::Load(const std::string &filename)
 {
-    Clear();
     Gui::LoadRawImage(filename, *this);
 }
 
+void Gui::Image::LoadThumbnail(const std::string &filename, int width, int height)
+{
+    Clear();
+    shared = textureCache.Get(filename, width, height);
+}
+
+void Gui::SetThumbnailDirectory(const std::string &directory)
+{
+    thumbnailDirectory = directory;
+}
+
 Gui::Image::Image()
 {
-    texture = nullptr;
-    w = 0;
-    h = 0;
 }
 
 Gui::Image::~Image()
@@ -5,6 +5,7 @@
 #include "imgui.h"
 
 #include <string>
+#include <memory>
 
 class Gui
 {
@@ -14,19 +15,22 @@ public:
     struct Texture;
 
     struct Image {
-        void *texture{nullptr}; // Platform specific
-        int w;
-        int h;
-
         std::string name;
+        std::shared_ptr<Texture> shared; // Same texture for all the images of a file
 
-        bool Valid() const {
-            return (w && h);
-        }
+        bool Valid() const;
+        bool IsLoading() const; // Not decoded yet
+        void *GetTexture() const; // Platform specific
+        // Part of the texture to draw (thumbnails are packed in atlas textures)
+        ImVec2 GetUv0() const;
+        ImVec2 GetUv1() const;
 
         void Clear();
 
+        // From the texture cache, the file is decoded only once, by a worker thread
         void Load(const std::string &filename);
+        // Downscaled copy that fits in width x height, kept on disk in the thumbnail directory
+        void LoadThumbnail(const std::string &filename, int width, int height);
 
         Image();
         ~Image();
@@ -47,6 +51,7 @@ public:
     void SetWindowTitle(const std::string &title);
 
     static bool LoadRawImage(const std::string &filename, Image &image);
+    static void SetThumbnailDirectory(const std::string &directory);
     static Size GetWindowSize();
 
 private:
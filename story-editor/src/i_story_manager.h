@@ -8,6 +8,7 @@
 
 #include "resource.h"
 #include "connection.h"
+#include "project_journal.h"
 
 class IStoryManager
 {
@@ -20,12 +21,17 @@ public:
     virtual std::string BuildFullAssetsPath(const std::string &fileName) const = 0;
 
     // Resources management
-    virtual std::pair<FilterIterator, FilterIterator> Images() = 0;
-    virtual std::pair<FilterIterator, FilterIterator> Sounds() = 0;
-    virtual std::pair<FilterIterator, FilterIterator> Resources() = 0;
+    virtual std::pair<ResourceIterator, ResourceIterator> Images() = 0;
+    virtual std::pair<ResourceIterator, ResourceIterator> Sounds() = 0;
+    virtual std::pair<ResourceIterator, ResourceIterator> Resources() = 0;
     virtual void AddResource(std::shared_ptr<Resource> res) = 0;
+    // Copies a file in the project assets, returns its content hash if it is shared with the library
+    virtual std::string ImportAsset(const std::string &sourceFile) = 0;
     virtual void ClearResources() = 0;
-    virtual void DeleteResource(FilterIterator &it) = 0;
+    virtual void DeleteResource(ResourceIterator &it) = 0;
+
+    // Changes of the node graph since the last save
+    virtual ProjectJournal &Journal() = 0;
 
     // Node interaction
     virtual void Build() = 0;
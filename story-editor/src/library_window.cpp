@@ -67,6 +67,20 @@ void LibraryWindow::Draw()
 
     ImGui::SameLine();
 
+    bool shareAssets = m_libraryManager.IsSharingAssets();
+    if (ImGui::Checkbox("Share identical assets between stories", &shareAssets))
+    {
+        m_libraryManager.SetShareAssets(shareAssets);
+    }
+    if (ImGui::IsItemHovered())
+    {
+        // See AssetStore: the shared files are hard links
+        ImGui::SetTooltip("The assets of the stories are hard links to a single file.\n"
+                          "Editing an asset in place with another application changes it in every story using it.");
+    }
+
+    ImGui::SameLine();
+
     if (ImGui::Button("Import story"))
     {
         ImGuiFileDialog::Instance()->OpenDialogWithPane("ImportStoryDlgKey", "Import story", "", "", InfosPane);
@@ -1,9 +1,11 @@
 #include "main_window.h"
 #include <filesystem>
+#include <sstream>
 #include <SDL.h>
 #include "platform_folders.h"
 
 #include "media_converter.h"
+#include "sha256.h"
 
 #ifdef USE_WINDOWS_OS
 #include <winsock2.h>
@@ -17,6 +19,9 @@
 
 #include "ImGuiFileDialog.h"
 
+// Journal entries before a full save of the project
+static const size_t cJournalMaxEntries = 1000;
+
 MainWindow::MainWindow()
     : m_emulatorWindow(*this)
     , m_resourcesWindow(*this)
@@ -44,6 +49,7 @@ MainWindow::MainWindow()
 
 MainWindow::~MainWindow()
 {
+    FinishSave(true);
     SaveParams();
 }
 
@@ -232,7 +238,20 @@ void MainWindow::DrawStatusBar()
     ImGuiWindowFlags windowFlags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoDocking;
     ImGui::Begin("StatusBar", nullptr, windowFlags);
 
-
+    if (IsSaving())
+    {
+        ImGui::TextUnformatted("Saving project...");
+        ImGui::SameLine();
+        ImGui::ProgressBar(m_saveProgress, ImVec2(12.f * ImGui::GetFontSize(), 0.0f));
+    }
+    else if (m_saveFailed)
+    {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", m_saveStatus.c_str());
+    }
+    else
+    {
+        ImGui::TextUnformatted(m_saveStatus.c_str());
+    }
 
     if (true)
     {
@@ -291,6 +310,11 @@ void MainWindow::DrawMainMenuBar()
                 SaveProject();
             }
 
+            if (ImGui::MenuItem("Export project (JSON)"))
+            {
+                ExportProject();
+            }
+
             if (ImGui::MenuItem("Close project"))
             {
                 CloseProject();
@@ -592,10 +616,77 @@ void MainWindow::ProjectPropertiesPopup()
 }
 
 void MainWindow::SaveProject()
+{
+    if (IsSaving())
+    {
+        Log("The project is already being saved");
+        return;
+    }
+
+    // Only the copy of the project data is done by the UI thread, the conversion to
+    // JSON/CBOR is done by the save task. The changes made during the save go to the
+    // journal and are saved by the next one
+    auto snapshot = std::make_shared<StoryProject::Snapshot>(m_story->MakeSnapshot(m_resources));
+    m_nodeEditorWindow.CopyGraph(snapshot->nodes, snapshot->links);
+    m_journal.BeginSave();
+
+    // Asset store references of the saved file, set when it is written
+    m_saveHashes.clear();
+    for (const auto &r : snapshot->resources)
+    {
+        if (!r.hash.empty())
+        {
+            m_saveHashes.insert(r.hash);
+        }
+    }
+
+    m_saveProgress = 0.0f;
+    m_saveStatus.clear();
+    m_saveResult = m_savePool.submit([this, snapshot]() {
+        std::string error;
+        StoryProject::WriteSnapshot(*snapshot, error, &m_saveProgress);
+        return error;
+    });
+}
+
+void MainWindow::FinishSave(bool wait)
+{
+    if (!IsSaving() ||
+        (!wait && (m_saveResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)))
+    {
+        return;
+    }
+
+    std::string error = m_saveResult.get();
+    m_saveFailed = !error.empty();
+    m_journal.EndSave(!m_saveFailed);
+    if (m_saveFailed)
+    {
+        m_saveStatus = "Cannot save the project: " + error;
+        Log(m_saveStatus, true);
+    }
+    else
+    {
+        m_libraryManager.GetAssetStore().SetReferences(m_story->GetUuid(), m_saveHashes);
+        m_saveStatus = "Project saved";
+    }
+}
+
+void MainWindow::ExportProject()
 {
     nlohmann::json model;
     m_nodeEditorWindow.Save(model);
-    m_story->Save(model, m_resources);
+
+    auto fileName = std::filesystem::path(m_story->GetWorkingDir()) / "export" / "project.json";
+    std::filesystem::create_directories(fileName.parent_path());
+    if (m_story->ExportJson(model, m_resources, fileName))
+    {
+        Log("Project exported to: " + fileName.string());
+    }
+    else
+    {
+        Log("Cannot export project to: " + fileName.string(), true);
+    }
 }
 
 void MainWindow::OpenProject(const std::string &uuid)
@@ -609,10 +700,16 @@ void MainWindow::OpenProject(const std::string &uuid)
     {
         Log("Cannot find story: " + uuid);
     }
-    else if (m_story->Load(model, m_resources))
+    else if (m_story->Load(m_resources) && m_story->LoadNodeGraph(model))
     {
         Log("Open project success");
+        Gui::SetThumbnailDirectory((std::filesystem::path(m_story->GetWorkingDir()) / "thumbnails").string());
         m_nodeEditorWindow.Load(model);
+        m_journal.Open(m_story->GetJournalFilePath());
+        if (m_journal.Entries() > 0)
+        {
+            Log(std::to_string(m_journal.Entries()) + " unsaved changes restored");
+        }
         auto proj = m_story->GetProjectFilePath();
         // Add to recent if not exists
         if (std::find(m_recentProjects.begin(), m_recentProjects.end(), proj) == m_recentProjects.end())
@@ -656,12 +753,18 @@ void MainWindow::RefreshProjectInformation()
 
 void MainWindow::CloseProject()
 {
+    FinishSave(true);
+    m_saveStatus.clear();
+    m_saveFailed = false;
+
     if (m_story)
     {
         m_story->Clear();
     }
 
     m_resources.Clear();
+    m_buildCache.Clear();
+    m_journal.Close();
 
     m_nodeEditorWindow.Clear();
     m_emulatorWindow.ClearImage();
@@ -693,10 +796,11 @@ void MainWindow::Loop()
 
         ImGui::DockSpaceOverViewport(ImGui::GetMainViewport());
         DrawMainMenuBar();
-       // DrawStatusBar();
+        DrawStatusBar();
 
 
         ProcessStory();
+        m_libraryManager.Update(); // Stories added, changed or removed outside of the editor
 
 
         // ------------  Draw all windows
@@ -718,6 +822,15 @@ void MainWindow::Loop()
         NewProjectPopup();
         ProjectPropertiesPopup();
 
+        FinishSave(false);
+
+        // Compaction: the journal is only the changes since a recent full save.
+        // Not retried automatically after a failed save, the next one is done by the user.
+        if (m_story && !IsSaving() && !m_saveFailed && (m_journal.Entries() >= cJournalMaxEntries))
+        {
+            SaveProject();
+        }
+
         if (aboutToClose)
         {
              ImGui::OpenPopup("QuitConfirm");
@@ -752,46 +865,87 @@ std::string MainWindow::BuildFullAssetsPath(const std::string &fileName) const
     return m_story->BuildFullAssetsPath(fileName);
 }
 
-std::pair<FilterIterator, FilterIterator> MainWindow::Images()
+std::pair<ResourceIterator, ResourceIterator> MainWindow::Images()
 {
     return m_resources.Images();
 }
 
-std::pair<FilterIterator, FilterIterator> MainWindow::Sounds()
+std::pair<ResourceIterator, ResourceIterator> MainWindow::Sounds()
 {
     return m_resources.Sounds();
 }
 
 void MainWindow::AddResource(std::shared_ptr<Resource> res)
 {
+    // The asset store references are updated when the project is saved
     m_resources.Add(res);
 }
 
+std::string MainWindow::ImportAsset(const std::string &sourceFile)
+{
+    std::filesystem::path source(sourceFile);
+    std::filesystem::path destination = m_story->BuildFullAssetsPath(source.filename().generic_string());
+
+    auto &store = m_libraryManager.GetAssetStore();
+    if (m_libraryManager.IsSharingAssets() && store.IsInitialized())
+    {
+        // Not referenced until the project is saved
+        std::string hash = store.Import(source);
+        if (!hash.empty() && store.Link(hash, destination))
+        {
+            return hash;
+        }
+        Log("Asset not shared: " + sourceFile, true);
+    }
+
+    std::error_code ec;
+    if (std::filesystem::equivalent(source, destination, ec))
+    {
+        return ""; // Already in the assets directory
+    }
+
+    // Not written in place: the previous file can be a link to the store
+    std::filesystem::remove(destination, ec);
+    ec.clear();
+    std::filesystem::copy_file(source, destination, ec);
+    if (ec)
+    {
+        Log("Cannot import " + sourceFile + ": " + ec.message(), true);
+    }
+    return "";
+}
+
 void MainWindow::ClearResources()
 {
     m_resources.Clear();
 }
 
-std::pair<FilterIterator, FilterIterator> MainWindow::Resources()
+std::pair<ResourceIterator, ResourceIterator> MainWindow::Resources()
 {
     return m_resources.Items();
 }
 
-void MainWindow::DeleteResource(FilterIterator &it)
+void MainWindow::DeleteResource(ResourceIterator &it)
 {
     return m_resources.Delete(it);
 }
 
 void MainWindow::Build()
 {
-    // 1. First compile nodes to assembly
-    CompileToAssembler();
+    // Unchanged nodes and assets are reused from the previous builds
+    m_buildCache.Load(m_story->GetWorkingDir());
 
-    // 2. Compile the assembly to machine binary
-    GenerateBinary();
+    // 1. First compile nodes to the assembler instructions
+    if (CompileToAssembler())
+    {
+        // 2. Encode the instructions to machine binary
+        GenerateBinary();
+    }
 
     // 3. Convert all media to desired type format
     ConvertResources();
+
+    m_buildCache.Save();
 }
 
 std::string MainWindow::GetNodeEntryLabel(unsigned long nodeId)
@@ -809,24 +963,28 @@ bool MainWindow::CompileToAssembler()
     // 1. Check if the model can be compiled, check for errors and report
     // FIXME
 
-    // 2. Generate the assembly code from the model
-    m_currentCode = m_nodeEditorWindow.Build();
+    // 2. Generate the instructions directly from the model, without assembly text
+    m_assembler.Clear();
+    bool success = m_nodeEditorWindow.Build(m_assembler, m_buildCache);
 
-    // Add global functions
-    {
-        std::string buffer;
+    // Add global functions, the assembler tokenizes this shared file once per session
+    success = success && m_assembler.Append(".include \"scripts/media.asm\"\n") && m_assembler.Link();
 
-        std::ifstream f("scripts/media.asm");
-        f.seekg(0, std::ios::end);
-        buffer.resize(f.tellg());
-        f.seekg(0);
-        f.read(buffer.data(), buffer.size());
-        m_currentCode += buffer;
+    // 3. The assembly text is only a listing for the code editor, its lines are used by the debugger
+    if (!m_editorWindow.IsDisabled())
+    {
+        std::stringstream source;
+        m_assembler.GenerateSource(source);
+        m_currentCode = source.str();
+        m_editorWindow.SetScript(m_currentCode);
     }
 
-    m_editorWindow.SetScript(m_currentCode);
+    if (!success)
+    {
+        Log(m_assembler.GetLastError().message, true);
+    }
 
-    return true;
+    return success;
 }
 
 void MainWindow::GenerateBinary()
@@ -834,32 +992,32 @@ void MainWindow::GenerateBinary()
     m_dbg.run_result = VM_FINISHED;
     m_dbg.free_run = false;
 
-    if (m_assembler.Parse(m_currentCode) == true )
+    if (m_assembler.BuildBinary(m_program, m_result) == true)
     {
-        if (m_assembler.BuildBinary(m_program, m_result) == true)
-        {
-            m_result.Print();
-
-            Log("Binary successfully generated.");
-
-            // Update ROM memory
-            std::copy(m_program.begin(), m_program.end(), m_rom_data);
-
-            // FIXME
-//            m_ramView->SetMemory(m_ram_data, sizeof(m_ram_data));
-//            m_romView->SetMemory(m_rom_data, m_program.size());
-            m_story->SaveBinary(m_program);
-            chip32_initialize(&m_chip32_ctx);
-            m_dbg.run_result = VM_READY;
-            UpdateVmView();
-            //            DebugContext::DumpCodeAssembler(m_assembler);
-        }
-        else
-        {
-            Chip32::Assembler::Error err = m_assembler.GetLastError();
-            Log(err.ToString(), true);
-            m_editorWindow.AddError(err.line, err.message); // show also the error in the code editor
-        }
+        m_result.Print();
+
+        Log("Binary successfully generated.");
+        Log("Constant pool: " + std::to_string(m_result.pooledSize) + " bytes saved");
+
+        // Update ROM memory
+        std::copy(m_program.begin(), m_program.end(), m_rom_data);
+
+        // FIXME
+//        m_ramView->SetMemory(m_ram_data, sizeof(m_ram_data));
+//        m_romView->SetMemory(m_rom_data, m_program.size());
+        m_story->SaveBinary(m_program);
+
+        // ROM/RAM map (JSON, for tooling) and annotated listing, to track the ROM budget per node
+        std::filesystem::path workingDir = m_story->GetWorkingDir();
+        std::ofstream mapFile(workingDir / "story.map.json");
+        m_assembler.GenerateMap(mapFile);
+        std::ofstream listingFile(workingDir / "story.lst");
+        m_assembler.GenerateListing(listingFile);
+
+        chip32_initialize(&m_chip32_ctx);
+        m_dbg.run_result = VM_READY;
+        UpdateVmView();
+        //            DebugContext::DumpCodeAssembler(m_assembler);
     }
     else
     {
@@ -906,26 +1064,75 @@ void MainWindow::UpdateVmView()
 
 void MainWindow::ConvertResources()
 {
-    auto [b, e] = m_resources.Items();
-    for (auto it = b; it != e; ++it)
+    // Only the assets of the reachable nodes and the story title are copied to the device
+    std::set<std::string> assets = m_nodeEditorWindow.GetBuildAssets();
+    assets.insert(m_story->GetTitleImage());
+    assets.insert(m_story->GetTitleSound());
+
+    auto &store = m_libraryManager.GetAssetStore();
+    for (const auto &file : assets)
     {
-        std::string inputfile = m_story->BuildFullAssetsPath((*it)->file.c_str());
-        std::string outputfile = std::filesystem::path(m_story->AssetsPath() / StoryProject::RemoveFileExtension((*it)->file)).string();
+        if (file.empty())
+        {
+            continue;
+        }
+
+        auto res = m_resources.Find(file);
+        if (!res)
+        {
+            Log("Skipped: " + file + ", not in the project resources", true);
+            continue;
+        }
+
+        std::string inputfile = m_story->BuildFullAssetsPath(res->file.c_str());
+        std::string outputfile = std::filesystem::path(m_story->AssetsPath() / StoryProject::RemoveFileExtension(res->file)).string();
 
         int retCode = 0;
-        if ((*it)->format == "PNG")
+        std::string format;
+        if (res->format == "PNG")
         {
-            outputfile += ".qoi"; // FIXME: prendre la congif en cours désirée
-            retCode = MediaConverter::ImageToQoi(inputfile, outputfile);
+            format = "qoi"; // FIXME: prendre la congif en cours désirée
         }
-        else if ((*it)->format == "MP3")
+        else if (res->format == "MP3")
         {
-            outputfile += ".wav"; // FIXME: prendre la congif en cours désirée
-            retCode = MediaConverter::Mp3ToWav(inputfile, outputfile);
+            format = "wav"; // FIXME: prendre la congif en cours désirée
         }
         else
         {
             Log("Skipped: " + inputfile + ", unknown format" + outputfile, true);
+            continue;
+        }
+        outputfile += "." + format;
+
+        if (m_buildCache.IsConverted(inputfile, outputfile))
+        {
+            continue; // Source file not modified since the last conversion
+        }
+
+        // Shared asset, unless it was modified in the project since its import
+        std::string hash;
+        if (!res->hash.empty() && (Sha256::File(inputfile) == res->hash))
+        {
+            hash = res->hash;
+        }
+
+        if (!hash.empty() && store.LinkConverted(hash, format, outputfile))
+        {
+            Log("Converted by another story: " + inputfile);
+            m_buildCache.SetConverted(inputfile, outputfile);
+            continue;
+        }
+
+        // Not written in place: the previous file can be a link to the store
+        std::filesystem::remove(outputfile);
+
+        if (res->format == "PNG")
+        {
+            retCode = MediaConverter::ImageToQoi(inputfile, outputfile);
+        }
+        else
+        {
+            retCode = MediaConverter::Mp3ToWav(inputfile, outputfile);
         }
 
         if (retCode < 0)
@@ -935,6 +1142,11 @@ void MainWindow::ConvertResources()
         else if (retCode == 0)
         {
             Log("Convertered file: " + inputfile);
+            m_buildCache.SetConverted(inputfile, outputfile);
+            if (!hash.empty())
+            {
+                store.AddConverted(hash, format, outputfile);
+            }
         }
     }
 }
@@ -946,6 +1158,7 @@ void MainWindow::SaveParams()
 
     j["recents"] = recents;
     j["library_path"] = m_libraryManager.LibraryPath();
+    j["share_assets"] = m_libraryManager.IsSharingAssets();
 
     std::string loc = pf::getConfigHome() + "/ost_settings.json";
     std::ofstream o(loc);
@@ -972,6 +1185,8 @@ void MainWindow::LoadParams()
             }
         }
 
+        m_libraryManager.SetShareAssets(j.value("share_assets", false));
+
         nlohmann::json library_path = j["library_path"];
 
         if (std::filesystem::exists(library_path))
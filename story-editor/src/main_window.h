@@ -3,6 +3,9 @@
 
 
 #include <functional>
+#include <future>
+#include <atomic>
+#include <set>
 
 #include "gui.h"
 #include "console_window.h"
@@ -21,6 +24,7 @@
 #include "audio_player.h"
 #include "library_manager.h"
 #include "library_window.h"
+#include "thread_pool.hpp"
 
 struct DebugContext
 {
@@ -106,11 +110,21 @@ private:
     Chip32::Result m_result;
     DebugContext m_dbg;
     std::string m_currentCode;
+    BuildCache m_buildCache;
 
 
     std::vector<std::string> m_recentProjects;
 
     ResourceManager m_resources;
+    ProjectJournal m_journal;
+
+    // Project save on a worker thread (see SaveProject())
+    std::atomic<float> m_saveProgress{0.0f};
+    std::string m_saveStatus; // Result of the last save, for the status bar
+    bool m_saveFailed{false};
+    std::future<std::string> m_saveResult; // Error message, empty on success
+    std::set<std::string> m_saveHashes; // Shared assets of the project being saved
+    thread_pool m_savePool{1};
 
     LibraryManager m_libraryManager;
 
@@ -144,13 +158,15 @@ private:
     virtual void Log(const std::string &txt, bool critical = false) override;
     virtual void PlaySoundFile(const std::string &fileName) override;;
     virtual std::string BuildFullAssetsPath(const std::string &fileName) const override;
-    virtual std::pair<FilterIterator, FilterIterator> Images() override;
-    virtual std::pair<FilterIterator, FilterIterator> Sounds() override;
+    virtual std::pair<ResourceIterator, ResourceIterator> Images() override;
+    virtual std::pair<ResourceIterator, ResourceIterator> Sounds() override;
 
     virtual void AddResource(std::shared_ptr<Resource> res) override;
+    virtual ProjectJournal &Journal() override { return m_journal; }
+    virtual std::string ImportAsset(const std::string &sourceFile) override;
     virtual void ClearResources() override;
-    virtual std::pair<FilterIterator, FilterIterator> Resources() override;
-    virtual void DeleteResource(FilterIterator &it) override;
+    virtual std::pair<ResourceIterator, ResourceIterator> Resources() override;
+    virtual void DeleteResource(ResourceIterator &it) override;
     virtual void Build() override;
     virtual std::list<std::shared_ptr<Connection>> GetNodeConnections(unsigned long nodeId) override;
     virtual std::string GetNodeEntryLabel(unsigned long nodeId) override;
@@ -171,6 +187,9 @@ private:
 
     void NewProjectPopup();
     void SaveProject();
+    bool IsSaving() const { return m_saveResult.valid(); }
+    void FinishSave(bool wait);
+    void ExportProject();
     void CloseProject();
     void DrawStatusBar();
 
@@ -0,0 +1,103 @@
+#include "media_code.h"
+
+#include "story_project.h"
+
+// Node id on 4 digits at least, the labels are built for every node at each build (no stringstream)
+static std::string PaddedId(unsigned long id)
+{
+    std::string s = std::to_string(id);
+    if (s.size() < 4)
+    {
+        s.insert(0, 4 - s.size(), '0');
+    }
+    return s;
+}
+
+std::string MediaCode::EntryLabel(unsigned long id)
+{
+    return ".mediaEntry" + PaddedId(id);
+}
+
+std::string MediaCode::ChoiceLabel() const
+{
+    return "mediaChoice" + PaddedId(id);
+}
+
+// File names are stored in ROM, the label is the file name without extension
+static bool AddFileConstant(Chip32::Assembler &assembler, const std::string &fileName, const std::string &extension)
+{
+    std::string f = StoryProject::RemoveFileExtension(fileName);
+    return assembler.AddRomData("$" + f, 8, { Chip32::Operand::Str(f + extension), Chip32::Operand::Imm(8) });
+}
+
+bool MediaCode::GenerateConstants(Chip32::Assembler &assembler) const
+{
+    bool success = true;
+
+    if (image.size() > 0)
+    {
+        success = AddFileConstant(assembler, image, ".qoi");  // FIXME: Generate the extension setup in user option of output format
+    }
+    if (sound.size() > 0)
+    {
+        success = success && AddFileConstant(assembler, sound, ".wav");  // FIXME: Generate the extension setup in user option of output format
+    }
+
+    if (outputs > 1)
+    {
+        // Generate choice table if needed (out ports > 1)
+        std::vector<Chip32::Operand> choices = { Chip32::Operand::Imm(outputs) };
+        for (const auto &t : targets)
+        {
+            choices.push_back(Chip32::Operand::Lbl(t));
+        }
+
+        success = success && assembler.AddRomData("$" + ChoiceLabel(), 32, choices);
+    }
+
+    return success;
+}
+
+bool MediaCode::Build(Chip32::Assembler &assembler) const
+{
+    using Chip32::Operand;
+
+    std::string imageLabel = StoryProject::RemoveFileExtension(image);
+    std::string soundLabel = StoryProject::RemoveFileExtension(sound);
+
+    bool success = assembler.AddLabel(EntryLabel(id));
+
+    // Call the media executor (image, sound)
+    success = success &&
+              assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), imageLabel.size() > 0 ? Operand::Lbl("$" + imageLabel) : Operand::Imm(0) }) &&
+              assembler.AddInstruction(OP_LCONS, { Operand::Reg(R1), soundLabel.size() > 0 ? Operand::Lbl("$" + soundLabel) : Operand::Imm(0) }) &&
+              assembler.AddInstruction(OP_SYSCALL, { Operand::Imm(1) });
+
+    // Check output connections number
+    // == 0: end node        : generate halt
+    // == 1: transition node : image + sound on demand, jump directly to the other node when OK
+    // > 1 : choice node     : call the node choice manager
+
+    if (outputs == 0) // End node
+    {
+        success = success && assembler.AddInstruction(OP_HALT);
+    }
+    else if (outputs == 1) // it is a transition node
+    {
+        for (const auto &t : targets)
+        {
+            // On place dans R0 le prochain noeud à exécuter en cas de OK
+            success = success &&
+                      assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl(t) }) &&
+                      assembler.AddInstruction(OP_RET);
+        }
+    }
+    else // Choice node
+    {
+        // no return possible, so a jump is enough
+        success = success &&
+                  assembler.AddInstruction(OP_LCONS, { Operand::Reg(R0), Operand::Lbl("$" + ChoiceLabel()) }) &&
+                  assembler.AddInstruction(OP_JUMP, { Operand::Lbl(".media") });
+    }
+    return success;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "chip32_assembler.h"
+
+// Code generation of a media node, without the editor (no ImGui): shows an image,
+// plays a sound, then goes to the next node (one output), to the choice manager of
+// media.asm (several outputs) or halts (no output).
+struct MediaCode
+{
+    unsigned long id{0};
+    std::string image; //!< file names of the resources, empty if none
+    std::string sound;
+    uint32_t outputs{0};
+    std::vector<std::string> targets; //!< entry labels of the connected nodes, in the connection order
+
+    static std::string EntryLabel(unsigned long id);
+    std::string ChoiceLabel() const;
+
+    bool GenerateConstants(Chip32::Assembler &assembler) const;
+    bool Build(Chip32::Assembler &assembler) const;
+};
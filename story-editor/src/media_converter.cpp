@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
 
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -66,6 +68,83 @@ int MediaConverter::ImageToQoi(const std::string &inputFileName, const std::stri
     return cSuccess;
 }
 
+int MediaConverter::ImageToThumbnail(const std::string &inputFileName, const std::string &outputFileName, int maxWidth, int maxHeight)
+{
+    int w = 0;
+    int h = 0;
+    uint8_t *pixels = stbi_load(inputFileName.c_str(), &w, &h, NULL, 4);
+
+    if (pixels == NULL)
+    {
+        return cErrorCannotDecodeInputFile;
+    }
+
+    float scale = std::min({ 1.0f, float(maxWidth) / w, float(maxHeight) / h });
+    int tw = std::max(1, int(w * scale));
+    int th = std::max(1, int(h * scale));
+
+    std::vector<uint8_t> thumbnail(size_t(tw) * th * 4);
+    BoxDownscale(pixels, w, h, thumbnail.data(), tw, th);
+    free(pixels);
+
+    qoi_desc desc;
+    desc.channels = 4;
+    desc.colorspace = QOI_SRGB;
+    desc.width = tw;
+    desc.height = th;
+
+    if (!qoi_write(outputFileName.c_str(), thumbnail.data(), &desc))
+    {
+        return cErrorCannotWriteOrEncodeOutputFile;
+    }
+
+    return cSuccess;
+}
+
+// Each destination pixel is the average of its block of source pixels (RGBA)
+void MediaConverter::BoxDownscale(const uint8_t *src, int srcW, int srcH, uint8_t *dst, int dstW, int dstH)
+{
+    std::vector<uint32_t> sums(size_t(dstW) * 4);
+
+    for (int y = 0; y < dstH; y++)
+    {
+        int y0 = y * srcH / dstH;
+        int y1 = std::max(y0 + 1, (y + 1) * srcH / dstH);
+
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int sy = y0; sy < y1; sy++)
+        {
+            const uint8_t *row = src + size_t(sy) * srcW * 4;
+            for (int x = 0; x < dstW; x++)
+            {
+                int x0 = x * srcW / dstW;
+                int x1 = std::max(x0 + 1, (x + 1) * srcW / dstW);
+                uint32_t *sum = &sums[size_t(x) * 4];
+                for (int sx = x0; sx < x1; sx++)
+                {
+                    const uint8_t *p = row + size_t(sx) * 4;
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    sum[3] += p[3];
+                }
+            }
+        }
+
+        uint8_t *out = dst + size_t(y) * dstW * 4;
+        for (int x = 0; x < dstW; x++)
+        {
+            int x0 = x * srcW / dstW;
+            int x1 = std::max(x0 + 1, (x + 1) * srcW / dstW);
+            uint32_t count = uint32_t(x1 - x0) * uint32_t(y1 - y0);
+            for (int c = 0; c < 4; c++)
+            {
+                out[x * 4 + c] = uint8_t((sums[size_t(x) * 4 + c] + count / 2) / count);
+            }
+        }
+    }
+}
+
 void fwrite_u32_le(unsigned int v, FILE *fh) {
     unsigned char buf[sizeof(unsigned int)];
     buf[0] = 0xff & (v      );
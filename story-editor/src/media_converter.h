@@ -21,8 +21,11 @@ public:
 
     MediaConverter();
     static int ImageToQoi(const std::string &inputFileName, const std::string &outputFileName);
+    // Downscaled QOI image that fits in maxWidth x maxHeight (aspect ratio kept, never upscaled)
+    static int ImageToThumbnail(const std::string &inputFileName, const std::string &outputFileName, int maxWidth, int maxHeight);
     static int Mp3ToWav(const std::string &inputFileName, const std::string &outputFileName);
 private:
+    static void BoxDownscale(const uint8_t *src, int srcW, int srcH, uint8_t *dst, int dstW, int dstH);
     static short *Mp3Read(const std::string &path, MediaInfo &desc);
     static int WavWrite(const std::string &path, short *sample_data, MediaInfo &desc);
 };
@@ -10,8 +10,6 @@ MediaNode::MediaNode(const std::string &title, IStoryManager &proj)
     : BaseNode(title, proj)
     , m_story(proj)
 {
-    Gui::LoadRawImage("fairy.png", m_image);
-
     // Create defaut one input and one output
     AddInput();
     AddOutputs(1);
@@ -45,12 +43,31 @@ void MediaNode::Draw()
     ImGui::PopStyleVar();
 
 
+    // The thumbnail is as big as the image on screen, the current one is shown until the next one is ready
+    int width = ThumbnailWidth(320.0f / ed::GetCurrentZoom());
+    if ((width != m_thumbnailWidth) && (m_imagePath.size() > 0))
+    {
+        m_thumbnailWidth = width;
+        m_nextImage.LoadThumbnail(m_imagePath, width, width * 3 / 4);
+    }
+    if (m_nextImage.shared && !m_nextImage.IsLoading())
+    {
+        m_image.shared = m_nextImage.shared;
+        m_nextImage.Clear();
+    }
+
     if (m_image.Valid())
     {
-        ImGui::Image(m_image.texture, ImVec2(320, 240));
+        ImGui::Image(m_image.GetTexture(), ImVec2(320, 240), m_image.GetUv0(), m_image.GetUv1());
     }
     else
     {
+        // Placeholder until the image is decoded
+        if (m_nextImage.IsLoading())
+        {
+            ImVec2 p = ImGui::GetCursorScreenPos();
+            ImGui::GetWindowDrawList()->AddText(ImVec2(p.x + 130, p.y + 110), ImGui::GetColorU32(ImGuiCol_TextDisabled), "Loading...");
+        }
         ImGui::Dummy(ImVec2(320, 240));
     }
 
@@ -113,6 +130,11 @@ void MediaNode::ToJson(nlohmann::json &j)
     j["sound"] = m_soundName;
 }
 
+void MediaNode::GetData(std::vector<std::pair<std::string, std::string>> &data) const
+{
+    data = { { "image", m_image.name }, { "sound", m_soundName } };
+}
+
 void MediaNode::DrawProperties()
 {
     ImGui::AlignTextToFramePadding();
@@ -131,6 +153,7 @@ void MediaNode::DrawProperties()
     ImGui::SameLine();
     if (ImGui::Button(ICON_MDI_CLOSE_BOX_OUTLINE "##delimage")) {
         SetImage("");
+        SetModified();
     }
 
 
@@ -157,6 +180,7 @@ void MediaNode::DrawProperties()
     ImGui::SameLine();
     if (ImGui::Button(ICON_MDI_CLOSE_BOX_OUTLINE "##delsound")) {
         SetSound("");
+        SetModified();
     }
 
     // This is the actual popup Gui drawing section.
@@ -177,6 +201,7 @@ void MediaNode::DrawProperties()
                 {
                     SetSound((*it)->file);
                 }
+                SetModified();
             }
         }
 
@@ -187,8 +212,24 @@ void MediaNode::DrawProperties()
 
 void MediaNode::SetImage(const std::string &f)
 {
+    // Loaded by the first Draw(), in the size of the zoom level
     m_image.name = f;
-    m_image.Load(m_story.BuildFullAssetsPath(f));
+    m_image.Clear();
+    m_nextImage.Clear();
+    // No image: nothing to load (the assets directory is not an image)
+    m_imagePath = f.empty() ? "" : m_story.BuildFullAssetsPath(f);
+    m_thumbnailWidth = 0;
+}
+
+int MediaNode::ThumbnailWidth(float displayWidth)
+{
+    // 80x60, 160x120 or 320x240
+    int width = 80;
+    while ((width < 320) && (width < displayWidth))
+    {
+        width *= 2;
+    }
+    return width;
 }
 
 void MediaNode::SetSound(const std::string &f)
@@ -200,137 +241,47 @@ void MediaNode::SetSound(const std::string &f)
 
 
 
-std::string MediaNode::ChoiceLabel() const
-{
-    std::stringstream ss;
-    ss << "mediaChoice" << std::setw(4) << std::setfill('0') << GetId();
-    return ss.str();
-}
-
 std::string MediaNode::GetEntryLabel()
 {
-    std::stringstream ss;
-    ss << ".mediaEntry" << std::setw(4) << std::setfill('0') << GetId();
-    return ss.str();
+    return MediaCode::EntryLabel(GetId());
 }
 
 
-std::string MediaNode::GenerateConstants()
+std::list<std::string> MediaNode::GetAssets() const
 {
-    std::string s;
-
+    std::list<std::string> assets;
     if (m_image.name.size() > 0)
     {
-        s = StoryProject::FileToConstant(m_image.name, ".qoi");  // FIXME: Generate the extension setup in user option of output format
+        assets.push_back(m_image.name);
     }
     if (m_soundName.size() > 0)
     {
-        s += StoryProject::FileToConstant(m_soundName, ".wav");  // FIXME: Generate the extension setup in user option of output format
+        assets.push_back(m_soundName);
     }
-
-    int nb_out_conns = Outputs();
-    if (nb_out_conns > 1)
-    {
-        // Generate choice table if needed (out ports > 1)
-        std::stringstream ss;
-        std::string label = ChoiceLabel();
-        ss << "$" << label
-           << " DC32, "
-           << nb_out_conns << ", ";
-
-        std::list<std::shared_ptr<Connection>> conns = m_story.GetNodeConnections(GetId());
-        int i = 0;
-        for (auto & c : conns)
-        {
-            std::stringstream ssChoice;
-
-            // On va chercher le label d'entrée du noeud connecté à l'autre bout
-            ss << m_story.GetNodeEntryLabel(c->inNodeId);
-            if (i < (nb_out_conns - 1))
-            {
-                ss << ", ";
-            }
-            else
-            {
-                ss << "\n";
-            }
-            i++;
-        }
-
-        s += ss.str();
-    }
-
-    return s;
+    return assets;
 }
 
-std::string MediaNode::Build()
+MediaCode MediaNode::GetCode() const
 {
-    std::stringstream ss;
-    int nb_out_conns = Outputs();
-
-    ss << R"(; ---------------------------- )"
-       << GetTitle()
-       << " Type: "
-       << (nb_out_conns == 0 ? "End" : nb_out_conns == 1 ? "Transition" : "Choice")
-       << "\n";
-    std::string image = StoryProject::RemoveFileExtension(m_image.name);
-    std::string sound = StoryProject::RemoveFileExtension(m_soundName);
-
-    // Le label de ce noeud est généré de la façon suivante :
-    // "media" + Node ID + id du noeud parent. Si pas de noeud parent, alors rien
-    ss << GetEntryLabel() << ":\n";
-
-    if (image.size() > 0)
-    {
-        ss << "lcons r0, $" << image  << "\n";
-    }
-    else
-    {
-        ss << "lcons r0, 0\n";
-    }
-
-    if (sound.size() > 0)
-    {
-        ss << "lcons r1, $" << sound  << "\n";
-    }
-    else
-    {
-        ss << "lcons r1, 0\n";
-    }
-    // Call the media executor (image, sound)
-    ss << "syscall 1\n";
-
-    // Check output connections number
-    // == 0: end node        : generate halt
-    // == 1: transition node : image + sound on demand, jump directly to the other node when OK
-    // > 1 : choice node     : call the node choice manager
-
-    if (nb_out_conns == 0) // End node
+    MediaCode code;
+    code.id = GetId();
+    code.image = m_image.name;
+    code.sound = m_soundName;
+    code.outputs = Outputs();
+    for (const auto &c : m_story.GetNodeConnections(GetId()))
     {
-        ss << "halt\n";
+        // On va chercher le label d'entrée du noeud connecté à l'autre bout
+        code.targets.push_back(m_story.GetNodeEntryLabel(c->inNodeId));
     }
-    else if (nb_out_conns == 1) // it is a transition node
-    {
-        std::list<std::shared_ptr<Connection>> conns = m_story.GetNodeConnections(GetId());
-
-
-        for (auto c : conns)
-        {
-            if (c->outNodeId == GetId())
-            {
-                // On place dans R0 le prochain noeud à exécuter en cas de OK
-                ss << "lcons r0, "
-                   << m_story.GetNodeEntryLabel(c->inNodeId) << "\n"
-                   << "ret\n";
-            }
-        }
+    return code;
+}
 
-    }
-    else // Choice node
-    {
-        ss << "lcons r0, $" << ChoiceLabel() << "\n"
-           << "jump .media ; no return possible, so a jump is enough";
-    }
-    return ss.str();
+bool MediaNode::GenerateConstants(Chip32::Assembler &assembler)
+{
+    return GetCode().GenerateConstants(assembler);
 }
 
+bool MediaNode::Build(Chip32::Assembler &assembler)
+{
+    return GetCode().Build(assembler);
+}
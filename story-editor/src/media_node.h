@@ -8,6 +8,7 @@
 #include "base_node.h"
 #include "i_story_manager.h"
 #include "gui.h"
+#include "media_code.h"
 #include <imgui_node_editor.h>
 
 
@@ -20,13 +21,18 @@ public:
 
     virtual void FromJson(const nlohmann::json &j) override;
     virtual void ToJson(nlohmann::json &j) override;
+    virtual void GetData(std::vector<std::pair<std::string, std::string>> &data) const override;
     virtual void DrawProperties() override;
-    virtual std::string Build() override;
+    virtual bool Build(Chip32::Assembler &assembler) override;
     virtual std::string GetEntryLabel() override;
-    virtual std::string GenerateConstants() override;
+    virtual std::list<std::string> GetAssets() const override;
+    virtual bool GenerateConstants(Chip32::Assembler &assembler) override;
 private:
     IStoryManager &m_story;
     Gui::Image  m_image;
+    Gui::Image  m_nextImage; // Thumbnail of another size, until it is decoded
+    std::string m_imagePath;
+    int m_thumbnailWidth{0};
     std::string m_soundName;
     std::string m_soundPath;
 
@@ -35,5 +41,7 @@ private:
     std::string m_buttonUniqueName;
     void SetImage(const std::string &f);
     void SetSound(const std::string &f);
-    std::string ChoiceLabel() const;
+    // Code generation data: the node and the entry labels of its connected nodes
+    MediaCode GetCode() const;
+    static int ThumbnailWidth(float displayWidth);
 };
@@ -17,6 +17,9 @@ if (!(x)) { \
 }
 #include "json.hpp"
 
+// Zoomed out further than this, the nodes are drawn as placeholders
+static const float cPlaceholderZoom = 2.5f;
+
 
 NodeEditorWindow::NodeEditorWindow(IStoryManager &proj)
     : WindowBase("Node editor")
@@ -35,6 +38,8 @@ void NodeEditorWindow::Initialize()
 {
     ed::Config config;
     config.SettingsFile = "Widgets.json";
+    config.SaveNodeSettings = OnSaveNodeSettings;
+    config.UserPointer = this;
     m_context = ed::CreateEditor(&config);
 
     ed::SetCurrentEditor(m_context);
@@ -43,9 +48,19 @@ void NodeEditorWindow::Initialize()
 void NodeEditorWindow::Clear()
 {
     m_nodes.clear();
+    m_links.clear();
+    m_nodeIndex.clear();
+    m_outLinks.clear();
+    m_inLinks.clear();
     m_ids.clear();
 }
 
+void NodeEditorWindow::AddNode(std::shared_ptr<BaseNode> node)
+{
+    m_nodes.push_back(node);
+    m_nodeIndex[node->GetId()] = node;
+}
+
 
 
 void NodeEditorWindow::LoadNode(const nlohmann::json &nodeJson)
@@ -68,7 +83,7 @@ void NodeEditorWindow::LoadNode(const nlohmann::json &nodeJson)
 
             m_ids.insert(restoredNodeId);
 
-            m_nodes.push_back(n);
+            AddNode(n);
         }
         else
         {
@@ -82,16 +97,40 @@ void NodeEditorWindow::LoadNode(const nlohmann::json &nodeJson)
 
 }
 
-int NodeEditorWindow::GenerateNodeId()
+bool NodeEditorWindow::OnSaveNodeSettings(ed::NodeId nodeId, const char *, size_t, ed::SaveReasonFlags reason, void *userPointer)
 {
-    int max = 1;
-    if (m_ids.size() > 0)
+    // Only the moves of the user, not the positions restored by the editor
+    const auto moved = ed::SaveReasonFlags::Position | ed::SaveReasonFlags::User;
+    if ((reason & moved) == moved)
     {
-        auto max = *m_ids.rbegin();
-        max++;
-        m_ids.insert(max);
+        static_cast<NodeEditorWindow *>(userPointer)->m_movedNodes.insert(nodeId.Get());
     }
-    return max;
+    return true;
+}
+
+void NodeEditorWindow::JournalMovedNodes()
+{
+    if (m_movedNodes.empty())
+    {
+        return;
+    }
+
+    for (const auto & n : m_nodes)
+    {
+        if (m_movedNodes.count(n->GetInternalId()) > 0)
+        {
+            m_story.Journal().NodeChanged(NodeToJson(n));
+        }
+    }
+    m_movedNodes.clear();
+}
+
+int NodeEditorWindow::GenerateNodeId()
+{
+    // Ids are unique in the project: the journal, the node index and the build cache use them
+    int id = m_ids.empty() ? 1 : *m_ids.rbegin() + 1;
+    m_ids.insert(id);
+    return id;
 }
 
 
@@ -99,12 +138,10 @@ ed::PinId NodeEditorWindow::GetInputPin(unsigned long modelNodeId, int pinIndex)
 {
     ed::PinId id = 0;
 
-    for (auto & n : m_nodes)
+    auto it = m_nodeIndex.find(modelNodeId);
+    if (it != m_nodeIndex.end())
     {
-        if (n->GetId() == modelNodeId)
-        {
-            id = n->GetInputPinAt(pinIndex);
-        }
+        id = it->second->GetInputPinAt(pinIndex);
     }
 
     if (id.Get() == 0)
@@ -119,12 +156,10 @@ ed::PinId NodeEditorWindow::GetOutputPin(unsigned long modelNodeId, int pinIndex
 {
     ed::PinId id = 0;
 
-    for (auto & n : m_nodes)
+    auto it = m_nodeIndex.find(modelNodeId);
+    if (it != m_nodeIndex.end())
     {
-        if (n->GetId() == modelNodeId)
-        {
-            id = n->GetOutputPinAt(pinIndex);
-        }
+        id = it->second->GetOutputPinAt(pinIndex);
     }
 
     if (id.Get() == 0)
@@ -140,8 +175,7 @@ void NodeEditorWindow::Load(const nlohmann::json &model)
     nlohmann::json nodesJsonArray = model["nodes"];
 
     BaseNode::InitId();
-    m_nodes.clear();
-    m_links.clear();
+    Clear();
 
     for (auto& element : nodesJsonArray) {
         LoadNode(element);
@@ -174,58 +208,73 @@ void NodeEditorWindow::CreateLink(const Connection &model, ed::PinId inId, ed::P
 
     // Since we accepted new link, lets add one to our list of links.
     m_links.push_back(conn);
+    m_outLinks[model.outNodeId].push_back(conn->model);
+    m_inLinks[model.inNodeId].push_back(conn->model);
 }
 
-void NodeEditorWindow::Save(nlohmann::json &model)
+void NodeEditorWindow::DeleteLink(ed::LinkId linkId)
 {
-    ed::SetCurrentEditor(m_context);
-    // Save nodes
+    auto it = std::find_if(m_links.begin(), m_links.end(), [linkId](const std::shared_ptr<LinkInfo> &inf) {
+        return inf->ed_link->Id == linkId;
+    });
 
-    nlohmann::json nodes = nlohmann::json::array();
-    for (const auto & n : m_nodes)
+    if (it != m_links.end())
     {
-        nlohmann::json node;
-        node["id"] = n->GetId();
-        node["type"] = n->GetType();
-        node["outPortCount"] = n->Outputs();
-        node["inPortCount"] = n->Inputs();
-
-        nlohmann::json position;
-        position["x"] = n->GetX();
-        position["y"] = n->GetY();
-
-        nlohmann::json internalData;
+        std::shared_ptr<Connection> model = (*it)->model;
+        m_story.Journal().LinkDeleted(*model);
+        m_outLinks[model->outNodeId].remove(model);
+        m_inLinks[model->inNodeId].remove(model);
+        m_links.erase(it);
+    }
+}
 
-        n->ToJson(internalData);
+void NodeEditorWindow::Save(nlohmann::json &model)
+{
+    std::vector<StoryProject::NodeData> nodes;
+    std::vector<StoryProject::LinkData> links;
+    CopyGraph(nodes, links);
+    model = StoryProject::GraphToJson(nodes, links);
+}
 
-        node["position"] = position;
-        node["internal-data"] = internalData;
-        nodes.push_back(node);
+void NodeEditorWindow::CopyGraph(std::vector<StoryProject::NodeData> &nodes, std::vector<StoryProject::LinkData> &links)
+{
+    ed::SetCurrentEditor(m_context);
+    nodes.clear();
+    nodes.reserve(m_nodes.size());
+    for (const auto & n : m_nodes)
+    {
+        nodes.push_back(CopyNode(n));
     }
 
-    model["nodes"] = nodes;
-
-    // Save links
-    nlohmann::json connections = nlohmann::json::array();
+    // The model is resolved from the pins when the link is created
+    links.clear();
+    links.reserve(m_links.size());
     for (const auto& linkInfo : m_links)
     {
-
-        nlohmann::json c;
-
-        Connection cnx = LinkToModel(linkInfo->ed_link->InputId, linkInfo->ed_link->OutputId);
-
-        c["outNodeId"] = cnx.outNodeId;
-        c["outPortIndex"] = cnx.outPortIndex;
-        c["inNodeId"] = cnx.inNodeId;
-        c["inPortIndex"] = cnx.inPortIndex;
-
-        connections.push_back(c);
+        const Connection &cnx = *linkInfo->model;
+        links.push_back({ cnx.outNodeId, cnx.outPortIndex, cnx.inNodeId, cnx.inPortIndex });
     }
-
-    model["connections"] = connections;
     ed::SetCurrentEditor(nullptr);
 }
 
+StoryProject::NodeData NodeEditorWindow::CopyNode(const std::shared_ptr<BaseNode> &n)
+{
+    StoryProject::NodeData node;
+    node.id = n->GetId();
+    node.type = n->GetType();
+    node.inputs = n->Inputs();
+    node.outputs = n->Outputs();
+    node.x = n->GetX();
+    node.y = n->GetY();
+    n->GetData(node.data);
+    return node;
+}
+
+nlohmann::json NodeEditorWindow::NodeToJson(const std::shared_ptr<BaseNode> &n)
+{
+    return StoryProject::NodeToJson(CopyNode(n));
+}
+
 Connection NodeEditorWindow::LinkToModel(ed::PinId InputId, ed::PinId OutputId)
 {
     Connection c;
@@ -248,97 +297,75 @@ Connection NodeEditorWindow::LinkToModel(ed::PinId InputId, ed::PinId OutputId)
     return c;
 }
 
-uint32_t NodeEditorWindow::FindFirstNode() const
+bool NodeEditorWindow::Build(Chip32::Assembler &assembler, BuildCache &cache)
 {
-    uint32_t id = 0;
-
-    // First node is the one without connection on its input port
+    ed::SetCurrentEditor(m_context);
 
-    for (const auto & n : m_nodes)
-    {
-        bool foundConnection = false;
-        for (const auto& l : m_links)
-        {
-            if (l->model->inNodeId == n->GetId())
-            {
-                foundConnection = true;
-            }
-        }
+    std::vector<std::shared_ptr<IBuildNode>> nodes(m_nodes.begin(), m_nodes.end());
+    bool success = m_builder.Build(nodes, m_outLinks, assembler, cache);
 
-        if (!foundConnection)
-        {
-            id = n->GetId();
-            m_story.Log("First node is: " + std::to_string(id));
-            break;
-        }
-    }
+    const StoryBuilder::Stats &stats = m_builder.GetStats();
+    m_story.Log("First node is: " + std::to_string(stats.firstNode));
+    m_story.Log("Build: " + std::to_string(stats.reachable) + " nodes (" +
+                std::to_string(stats.cached) + " from cache), " +
+                std::to_string(m_nodes.size() - stats.reachable) + " unreachable removed, " +
+                std::to_string(stats.merged) + " merged");
 
-    return id;
+    ed::SetCurrentEditor(nullptr);
+    return success;
 }
 
-std::string NodeEditorWindow::Build()
+std::list<std::shared_ptr<Connection>> NodeEditorWindow::GetNodeConnections(unsigned long nodeId)
 {
-    std::stringstream code;
-    ed::SetCurrentEditor(m_context);
-
-
-    std::stringstream chip32;
-
-    uint32_t firstNode = FindFirstNode();
-
-    code << "\tjump    " << GetNodeEntryLabel(firstNode) << "\r\n";
-
-    // First generate all constants
-    for (const auto & n : m_nodes)
+    auto it = m_outLinks.find(nodeId);
+    if (it != m_outLinks.end())
     {
-        code << n->GenerateConstants() << "\n";
+        return it->second;
     }
+    return std::list<std::shared_ptr<Connection>>();
+}
 
-    for (const auto & n : m_nodes)
+std::string NodeEditorWindow::GetNodeEntryLabel(unsigned long nodeId)
+{
+    std::string label;
+
+    auto it = m_nodeIndex.find(nodeId);
+    if (it != m_nodeIndex.end())
     {
-        code << n->Build() << "\n";
+        label = it->second->GetEntryLabel();
     }
-
-    ed::SetCurrentEditor(nullptr);
-    return code.str();
+    return label;
 }
 
-std::list<std::shared_ptr<Connection>> NodeEditorWindow::GetNodeConnections(unsigned long nodeId)
-{
-    std::list<std::shared_ptr<Connection>> c;
-    ed::SetCurrentEditor(m_context);
 
-    for (const auto & l : m_links)
+bool NodeEditorWindow::IsLinkedToVisibleNode(unsigned long nodeId)
+{
+    auto out = m_outLinks.find(nodeId);
+    if (out != m_outLinks.end())
     {
-        if (l->model->outNodeId == nodeId)
+        for (const auto & c : out->second)
         {
-            c.push_back(l->model);
+            if (m_visibleNodes.count(c->inNodeId) > 0)
+            {
+                return true;
+            }
         }
     }
 
-    ed::SetCurrentEditor(nullptr);
-    return c;
-}
-
-std::string NodeEditorWindow::GetNodeEntryLabel(unsigned long nodeId)
-{
-    std::string label;
-    ed::SetCurrentEditor(m_context);
-
-    for (const auto & n : m_nodes)
+    auto in = m_inLinks.find(nodeId);
+    if (in != m_inLinks.end())
     {
-        if (n->GetId() == nodeId)
+        for (const auto & c : in->second)
         {
-            label = n->GetEntryLabel();
-            break;
+            if (m_visibleNodes.count(c->outNodeId) > 0)
+            {
+                return true;
+            }
         }
     }
-
-    ed::SetCurrentEditor(nullptr);
-    return label;
+    return false;
 }
 
-
 std::shared_ptr<BaseNode> NodeEditorWindow::GetSelectedNode()
 {
     std::shared_ptr<BaseNode> selected;
@@ -371,14 +398,51 @@ void NodeEditorWindow::Draw()
     if (WindowBase::BeginDraw())
     {
 
+        // The editor fills the window, its visible area in canvas coordinates is known after Begin()
+        ImVec2 screenMin = ImGui::GetCursorScreenPos();
+        ImVec2 screenMax(screenMin.x + ImGui::GetContentRegionAvail().x, screenMin.y + ImGui::GetContentRegionAvail().y);
+
         ed::SetCurrentEditor(m_context);
         ed::Begin("My Editor", ImVec2(0.0, 0.0f));
 
+        ImVec2 viewMin = ed::ScreenToCanvas(screenMin);
+        ImVec2 viewMax = ed::ScreenToCanvas(screenMax);
+        bool farView = ed::GetCurrentZoom() > cPlaceholderZoom;
 
+        m_visibleNodes.clear();
         for (const auto & n : m_nodes)
         {
+            if (n->IsVisible(viewMin, viewMax))
+            {
+                m_visibleNodes.insert(n->GetId());
+            }
+
+            // Edited in the properties window
+            if (n->TakeModified())
+            {
+                m_story.Journal().NodeChanged(NodeToJson(n));
+            }
+        }
+
+        // Off-screen nodes are not submitted, except the ones linked to a visible node:
+        // their placeholder gives the pins to draw the link.
+        for (const auto & n : m_nodes)
+        {
+            bool visible = m_visibleNodes.count(n->GetId()) > 0;
+            if (!visible && !IsLinkedToVisibleNode(n->GetId()))
+            {
+                continue;
+            }
+
             ImGui::PushID(n->GetInternalId());
-            n->Draw();
+            if (visible && !farView)
+            {
+                n->Draw();
+            }
+            else
+            {
+                n->DrawPlaceholder();
+            }
             ImGui::PopID();
         }
 
@@ -413,6 +477,7 @@ void NodeEditorWindow::Draw()
                        Connection model = LinkToModel(inputPinId, outputPinId);
 
                        CreateLink(model, inputPinId, outputPinId);
+                       m_story.Journal().LinkAdded(model);
 
                        // Draw new link.
                        ed::Link(m_links.back()->ed_link->Id, inputPinId, outputPinId);
@@ -437,13 +502,7 @@ void NodeEditorWindow::Draw()
                // If you agree that link can be deleted, accept deletion.
                if (ed::AcceptDeletedItem())
                {
-
-                   m_links.erase(std::remove_if(m_links.begin(),
-                                  m_links.end(),
-                                [deletedLinkId](std::shared_ptr<LinkInfo> inf)
-                                {
-                                    return inf->ed_link->Id == deletedLinkId;
-                                }));
+                   DeleteLink(deletedLinkId);
                }
 
                // You may reject link deletion by calling:
@@ -473,7 +532,8 @@ void NodeEditorWindow::Draw()
                     n->SetType("media-node"); // FIXME: set type in createNode factory?
                     n->SetId(GenerateNodeId());
                     n->SetPosition(newNodePostion.x, newNodePostion.y);
-                    m_nodes.push_back(n);
+                    AddNode(n);
+                    m_story.Journal().NodeChanged(NodeToJson(n));
                 }
             }
 
@@ -489,6 +549,7 @@ void NodeEditorWindow::Draw()
 
 
         ed::End();
+        JournalMovedNodes(); // The moves are known when the editor saves its settings, in End()
         ed::SetCurrentEditor(nullptr);
 
     }
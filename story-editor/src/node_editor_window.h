@@ -2,13 +2,18 @@
 
 #include <map>
 #include <set>
-#include <set>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <imgui_node_editor.h>
 #include "base_node.h"
 #include "window_base.h"
 #include "i_story_manager.h"
 #include "json.hpp"
+#include "build_cache.h"
+#include "story_builder.h"
+#include "story_project.h"
+#include "thread_pool.hpp"
 
 
 namespace ed = ax::NodeEditor;
@@ -54,7 +59,11 @@ public:
     void Clear();
     void Load(const nlohmann::json &model);
     void Save(nlohmann::json &model);
-    std::string Build();
+    // Plain copy of the nodes and links, converted to JSON by the save thread
+    void CopyGraph(std::vector<StoryProject::NodeData> &nodes, std::vector<StoryProject::LinkData> &links);
+    bool Build(Chip32::Assembler &assembler, BuildCache &cache);
+    // Resource files used by the nodes of the last build
+    const std::set<std::string> &GetBuildAssets() const { return m_builder.GetAssets(); }
     std::list<std::shared_ptr<Connection> > GetNodeConnections(unsigned long nodeId);
     std::string GetNodeEntryLabel(unsigned long nodeId);
 
@@ -68,6 +77,16 @@ private:
     // key: Id
     std::list<std::shared_ptr<BaseNode>>   m_nodes;
     std::list<std::shared_ptr<LinkInfo>>   m_links;                // List of live links. It is dynamic unless you want to create read-only view over nodes.
+
+    // Graph index, updated when nodes and links are added or removed
+    std::unordered_map<unsigned long, std::shared_ptr<BaseNode>> m_nodeIndex; // key: node Id
+    std::unordered_map<unsigned long, std::list<std::shared_ptr<Connection>>> m_outLinks; // key: node Id, links from its output ports
+    std::unordered_map<unsigned long, std::list<std::shared_ptr<Connection>>> m_inLinks; // key: node Id, links to its input ports
+
+    std::unordered_set<unsigned long> m_visibleNodes; // Nodes in the view, updated every frame
+    std::unordered_set<unsigned long> m_movedNodes; // key: internal Id, moved by the user since the last frame
+    thread_pool m_pool; // code generation of the nodes
+    StoryBuilder m_builder{m_pool};
     void ToolbarUI();
 
     std::set<int> m_ids;
@@ -113,11 +132,17 @@ private:
     }
 
     void LoadNode(const nlohmann::json &nodeJson);
+    nlohmann::json NodeToJson(const std::shared_ptr<BaseNode> &node);
+    StoryProject::NodeData CopyNode(const std::shared_ptr<BaseNode> &node);
+    void JournalMovedNodes();
+    static bool OnSaveNodeSettings(ed::NodeId nodeId, const char *data, size_t size, ed::SaveReasonFlags reason, void *userPointer);
     ed::PinId GetInputPin(unsigned long modelNodeId, int pinIndex);
     ed::PinId GetOutputPin(unsigned long modelNodeId, int pinIndex);
-    uint32_t FindFirstNode() const;
+    bool IsLinkedToVisibleNode(unsigned long nodeId);
     int GenerateNodeId();
+    void AddNode(std::shared_ptr<BaseNode> node);
     void CreateLink(const Connection &model, ed::PinId inId, ed::PinId outId);
+    void DeleteLink(ed::LinkId linkId);
     Connection LinkToModel(ed::PinId InputId, ed::PinId OutputId);
 };
 
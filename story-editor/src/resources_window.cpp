@@ -43,17 +43,16 @@ void ResourcesWindow::ChooseFile()
 
 
             std::filesystem::path p(filePathName);
-            std::filesystem::path p2 = m_story.BuildFullAssetsPath( p.filename().generic_string());
-            std::filesystem::copy(p, p2, std::filesystem::copy_options::overwrite_existing);
 
             auto res = std::make_shared<Resource>();
+            res->hash = m_story.ImportAsset(filePathName);
 
             std::string ext = p.extension().string();
             ext.erase(ext.begin()); // remove '.' dot sign
             std::transform(ext.begin(), ext.end(), ext.begin(), ::toupper);
 
             res->format = ext;
-            res->type = m_soundFile ? "sound" : "image";
+            res->type = m_soundFile ? Resource::TYPE_SOUND : Resource::TYPE_IMAGE;
             res->file = p.filename().generic_string();
             m_story.AddResource(res);
         }
@@ -146,7 +145,7 @@ void ResourcesWindow::Draw()
 
 
             ImGui::TableNextColumn();
-            ImGui::Text("%s", (*it)->type.c_str());
+            ImGui::Text("%s", Resource::TypeToString((*it)->type).c_str());
 
             ImGui::TableNextColumn();
             if (ImGui::SmallButton("Delete"))
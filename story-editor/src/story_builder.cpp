@@ -0,0 +1,256 @@
+#include "story_builder.h"
+
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <unordered_set>
+
+#include "fnv1a.h"
+
+const std::list<std::shared_ptr<Connection>> &StoryBuilder::GetConnections(unsigned long nodeId) const
+{
+    static const std::list<std::shared_ptr<Connection>> none;
+    auto it = m_outLinks->find(nodeId);
+    return (it != m_outLinks->end()) ? it->second : none;
+}
+
+std::string StoryBuilder::GetEntryLabel(unsigned long nodeId) const
+{
+    auto it = m_nodeIndex.find(nodeId);
+    return (it != m_nodeIndex.end()) ? it->second->GetEntryLabel() : "";
+}
+
+unsigned long StoryBuilder::FindFirstNode(const std::vector<std::shared_ptr<IBuildNode>> &nodes) const
+{
+    // First node is the one without connection on its input port
+    std::unordered_set<unsigned long> targets;
+    for (const auto & l : *m_outLinks)
+    {
+        for (const auto & c : l.second)
+        {
+            targets.insert(c->inNodeId);
+        }
+    }
+
+    for (const auto & n : nodes)
+    {
+        if (targets.count(n->GetId()) == 0)
+        {
+            return n->GetId();
+        }
+    }
+    return 0;
+}
+
+std::vector<std::shared_ptr<IBuildNode>> StoryBuilder::ReachableNodes(unsigned long firstNode) const
+{
+    // Breadth-first walk from the entry node, the order is the layout of the nodes in ROM
+    std::vector<std::shared_ptr<IBuildNode>> nodes;
+    std::set<unsigned long> visited;
+    std::deque<unsigned long> queue = { firstNode };
+
+    while (queue.size() > 0)
+    {
+        unsigned long id = queue.front();
+        queue.pop_front();
+
+        auto it = m_nodeIndex.find(id);
+        if ((it == m_nodeIndex.end()) || !visited.insert(id).second)
+        {
+            continue;
+        }
+        nodes.push_back(it->second);
+
+        for (const auto & c : GetConnections(id))
+        {
+            queue.push_back(c->inNodeId);
+        }
+    }
+    return nodes;
+}
+
+uint64_t StoryBuilder::NodeHash(const std::shared_ptr<IBuildNode> &node) const
+{
+    // The generated code depends on the node data and on the labels of the connected nodes
+    uint64_t fields[] = { node->GetId(), node->Outputs(), node->DataHash() };
+    uint64_t hash = Fnv1a(fields, sizeof(fields), BuildCache::Hash(node->GetType()));
+    for (const auto & c : GetConnections(node->GetId()))
+    {
+        uint64_t port = c->outPortIndex;
+        hash = Fnv1a(GetEntryLabel(c->inNodeId), Fnv1a(&port, sizeof(port), hash));
+    }
+    return hash;
+}
+
+// Hash of the statements, to find identical code
+static uint64_t StatementsHash(std::vector<Chip32::Statement>::const_iterator begin, std::vector<Chip32::Statement>::const_iterator end)
+{
+    uint64_t hash = cFnv1aBasis;
+    for (auto s = begin; s != end; ++s)
+    {
+        uint32_t fields[] = { s->type, s->op, s->typeSize, s->count };
+        hash = Fnv1a(fields, sizeof(fields), hash);
+        hash = Fnv1a(s->label, hash);
+        for (const auto & a : s->args)
+        {
+            uint32_t operand[] = { a.type, a.value };
+            hash = Fnv1a(operand, sizeof(operand), hash);
+            hash = Fnv1a(a.text, hash);
+        }
+    }
+    return hash;
+}
+
+bool StoryBuilder::Build(const std::vector<std::shared_ptr<IBuildNode>> &allNodes, const Links &outLinks, Chip32::Assembler &assembler, BuildCache &cache)
+{
+    m_outLinks = &outLinks;
+    m_nodeIndex.clear();
+    for (const auto & n : allNodes)
+    {
+        m_nodeIndex[n->GetId()] = n;
+    }
+    m_assets.clear();
+    m_stats = Stats();
+
+    m_stats.firstNode = FindFirstNode(allNodes);
+    bool success = assembler.AddInstruction(OP_JUMP, { Chip32::Operand::Lbl(GetEntryLabel(m_stats.firstNode)) });
+
+    // 1. Unreachable nodes are not part of the story, nor their assets
+    std::vector<std::shared_ptr<IBuildNode>> nodes = ReachableNodes(m_stats.firstNode);
+    m_stats.reachable = nodes.size();
+
+    // 2. Statements of each node: unchanged nodes share the fragment of the cache, the
+    // others are generated in parallel, each one in a scratch assembler, and recorded.
+    // The nodes only read the graph during the generation. Results are stored by
+    // node index, so the program is the same as a serial build.
+    std::vector<uint64_t> hashes(nodes.size());
+    std::vector<std::shared_ptr<const BuildCache::Fragment>> fragments(nodes.size());
+    std::vector<std::shared_ptr<BuildCache::Fragment>> created(nodes.size());
+    std::vector<uint8_t> generated(nodes.size(), 1);
+    std::vector<Chip32::Assembler::Error> errors(nodes.size());
+
+    m_pool.parallelize_loop(size_t(0), nodes.size(), [this, &nodes, &hashes](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++)
+        {
+            hashes[i] = NodeHash(nodes[i]);
+        }
+    });
+
+    cache.BeginBuild();
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        fragments[i] = cache.FindFragment(nodes[i]->GetId(), hashes[i]);
+        if (fragments[i] != nullptr)
+        {
+            m_stats.cached++;
+        }
+        else
+        {
+            created[i] = std::make_shared<BuildCache::Fragment>();
+            created[i]->hash = hashes[i];
+            fragments[i] = created[i];
+        }
+
+        for (const auto & a : nodes[i]->GetAssets())
+        {
+            m_assets.insert(a);
+        }
+    }
+
+    m_pool.parallelize_loop(size_t(0), nodes.size(), [&nodes, &created, &generated, &errors](size_t start, size_t end) {
+        Chip32::Assembler scratch;
+        for (size_t i = start; i < end; i++)
+        {
+            if (created[i] == nullptr)
+            {
+                continue;
+            }
+            scratch.Clear();
+            scratch.SetRecorder(&created[i]->constants, true);
+            bool ok = nodes[i]->GenerateConstants(scratch);
+            scratch.SetRecorder(&created[i]->code, true);
+            ok = ok && nodes[i]->Build(scratch);
+            scratch.SetRecorder(nullptr);
+            if (!ok)
+            {
+                generated[i] = 0;
+                errors[i] = scratch.GetLastError();
+            }
+        }
+    });
+
+    // First error in the node order
+    for (size_t i = 0; (i < nodes.size()) && success; i++)
+    {
+        if (!generated[i])
+        {
+            assembler.SetLastError(errors[i]);
+            success = false;
+        }
+    }
+
+    // 3. Constants first
+    for (const auto & f : fragments)
+    {
+        success = success && assembler.Replay(f->constants);
+    }
+
+    // 4. Nodes with the same code after their entry label (eg: end nodes with
+    // the same media) share one copy: their labels are emitted in a row
+    std::vector<std::vector<size_t>> groups;
+    std::unordered_map<uint64_t, std::vector<size_t>> bodies; // key: hash of the code after the entry label, value: groups
+    for (size_t i = 0; i < fragments.size(); i++)
+    {
+        const auto & code = fragments[i]->code;
+        bool hasEntry = (code.size() > 0) && (code[0].type == Chip32::Statement::Label);
+        if (!hasEntry)
+        {
+            groups.push_back({ i });
+            continue;
+        }
+
+        auto & candidates = bodies[StatementsHash(code.begin() + 1, code.end())];
+        auto same = std::find_if(candidates.begin(), candidates.end(), [&](size_t g) {
+            const auto & other = fragments[groups[g][0]]->code;
+            return std::equal(code.begin() + 1, code.end(), other.begin() + 1, other.end());
+        });
+        if (same != candidates.end())
+        {
+            groups[*same].push_back(i);
+        }
+        else
+        {
+            candidates.push_back(groups.size());
+            groups.push_back({ i });
+        }
+    }
+    m_stats.merged = fragments.size() - groups.size();
+
+    for (const auto & g : groups)
+    {
+        const auto & code = fragments[g[0]]->code;
+        for (size_t i = 1; i < g.size(); i++)
+        {
+            success = success && assembler.Replay({ fragments[g[i]]->code[0] });
+        }
+        success = success && assembler.Replay(code);
+    }
+
+    // Fragments are incomplete after an error, keep the previous cache
+    if (success)
+    {
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (created[i] != nullptr)
+            {
+                cache.StoreFragment(nodes[i]->GetId(), created[i]);
+            }
+        }
+        cache.EndBuild();
+    }
+
+    // The nodes are not kept after the build
+    m_nodeIndex.clear();
+    m_outLinks = nullptr;
+    return success;
+}
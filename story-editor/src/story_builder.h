@@ -0,0 +1,75 @@
+#pragma once
+
+#include <set>
+#include <list>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+#include "json.hpp"
+#include "chip32_assembler.h"
+#include "build_cache.h"
+#include "connection.h"
+#include "thread_pool.hpp"
+
+// Node as seen by the code generation (implemented by BaseNode)
+class IBuildNode
+{
+public:
+    virtual ~IBuildNode() {}
+
+    virtual unsigned long GetId() const = 0;
+    virtual std::string GetType() const = 0;
+    virtual uint32_t Outputs() const = 0;
+    // Node data, part of the build cache key
+    virtual void ToJson(nlohmann::json &j) = 0;
+    // Hash of ToJson(), kept by the node until its data changes
+    virtual uint64_t DataHash() = 0;
+    virtual std::string GetEntryLabel() = 0;
+    // Resource files used by the node, converted during the build
+    virtual std::list<std::string> GetAssets() const = 0;
+    // Called from the worker threads, the graph is only read
+    virtual bool GenerateConstants(Chip32::Assembler &assembler) = 0;
+    virtual bool Build(Chip32::Assembler &assembler) = 0;
+};
+
+// Code generation of the node graph, without the editor (no ImGui): used by the node
+// editor and by the benchmark. The program starts with a jump to the first node (the
+// one without input connection), followed by the constants then the code of the
+// nodes reachable from it.
+class StoryBuilder
+{
+public:
+    using Links = std::unordered_map<unsigned long, std::list<std::shared_ptr<Connection>>>; // key: node Id
+
+    struct Stats {
+        unsigned long firstNode{0};
+        size_t reachable{0};
+        size_t cached{0};
+        size_t merged{0}; //!< nodes sharing the code of another node
+    };
+
+    StoryBuilder(thread_pool &pool) : m_pool(pool) {}
+
+    // nodes: in the editor order, outLinks: links from the output ports of each node
+    bool Build(const std::vector<std::shared_ptr<IBuildNode>> &nodes, const Links &outLinks, Chip32::Assembler &assembler, BuildCache &cache);
+
+    // Result of the last build
+    const Stats &GetStats() const { return m_stats; }
+    const std::set<std::string> &GetAssets() const { return m_assets; }
+
+private:
+    thread_pool &m_pool;
+    std::unordered_map<unsigned long, std::shared_ptr<IBuildNode>> m_nodeIndex; // key: node Id, during the build
+    const Links *m_outLinks{nullptr};
+    std::set<std::string> m_assets;
+    Stats m_stats;
+
+    const std::list<std::shared_ptr<Connection>> &GetConnections(unsigned long nodeId) const;
+    std::string GetEntryLabel(unsigned long nodeId) const;
+    unsigned long FindFirstNode(const std::vector<std::shared_ptr<IBuildNode>> &nodes) const;
+    std::vector<std::shared_ptr<IBuildNode>> ReachableNodes(unsigned long firstNode) const;
+    uint64_t NodeHash(const std::shared_ptr<IBuildNode> &node) const;
+};